@@ -0,0 +1,131 @@
+/*********************************************************************
+ * File Name    : g711_bench.c
+ * Description  : Compare G.711 decoding of g711.c(SSSE3/NEON) with
+ *                a 256 entries lookup table, across many channels.
+ *                Usage: g711_bench [channels] [rounds]
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-03-12
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "g711.h"
+
+
+#define DFL_CHN_NUM     4000
+#define DFL_ROUND_NUM   200
+#define PKT_SZ          160     /* 20ms at 8kHz */
+
+static short alaw_tbl[256];
+static short ulaw_tbl[256];
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * The table is built sample by sample, which takes the scalar path
+ * of g711.c, so it also checks the vector path.
+ */
+static void build_tbl(void)
+{
+    unsigned char in = 0;
+    unsigned int i = 0;
+
+    for (i = 0; i < 256; i++) {
+        in = i;
+        alaw_to_pcm16(&in, &alaw_tbl[i], 1);
+        ulaw_to_pcm16(&in, &ulaw_tbl[i], 1);
+    }
+    return;
+}
+
+static void tbl_to_pcm16(const short *tbl, const unsigned char *in, short *out, unsigned int n)
+{
+    unsigned int i = 0;
+
+    for (i = 0; i < n; i++) {
+        out[i] = tbl[in[i]];
+    }
+    return;
+}
+
+/* Decode every packet of every channel, rounds times, return ns per packet. */
+static double run(int use_tbl, int ulaw, const unsigned char *in, short *out,
+                  unsigned int chn_num, unsigned int round_num)
+{
+    unsigned long long start = 0;
+    unsigned int r = 0;
+    unsigned int c = 0;
+
+    start = now_ns();
+    for (r = 0; r < round_num; r++) {
+        for (c = 0; c < chn_num; c++) {
+            if (use_tbl) {
+                tbl_to_pcm16(ulaw ? ulaw_tbl : alaw_tbl, in + c * PKT_SZ,
+                             out + c * PKT_SZ, PKT_SZ);
+            } else if (ulaw) {
+                ulaw_to_pcm16(in + c * PKT_SZ, out + c * PKT_SZ, PKT_SZ);
+            } else {
+                alaw_to_pcm16(in + c * PKT_SZ, out + c * PKT_SZ, PKT_SZ);
+            }
+        }
+    }
+    return (double)(now_ns() - start) / ((double)round_num * chn_num);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int chn_num = argc > 1 ? atoi(argv[1]) : DFL_CHN_NUM;
+    unsigned int round_num = argc > 2 ? atoi(argv[2]) : DFL_ROUND_NUM;
+    unsigned char *in = NULL;
+    short *out = NULL;
+    short *ref = NULL;
+    double simd = 0;
+    double tbl = 0;
+    unsigned int i = 0;
+    int ulaw = 0;
+
+    if (!chn_num || !round_num) {
+        printf("Usage: %s [channels] [rounds]\n", argv[0]);
+        return -1;
+    }
+
+    in = malloc(chn_num * PKT_SZ);
+    out = malloc(chn_num * PKT_SZ * sizeof(short));
+    ref = malloc(chn_num * PKT_SZ * sizeof(short));
+    if (!in || !out || !ref) {
+        printf("Allocate buffers failed!\n");
+        return -1;
+    }
+    srand(1);
+    for (i = 0; i < chn_num * PKT_SZ; i++) {
+        in[i] = rand();
+    }
+    build_tbl();
+
+    printf("%u channels x %u bytes, %u rounds\n", chn_num, PKT_SZ, round_num);
+    for (ulaw = 0; ulaw < 2; ulaw++) {
+        run(0, ulaw, in, out, chn_num, 1);      /* warm up */
+        run(1, ulaw, in, ref, chn_num, 1);
+        if (memcmp(out, ref, chn_num * PKT_SZ * sizeof(short))) {
+            printf("%s: output differs from table!\n", ulaw ? "u-law" : "A-law");
+            return -1;
+        }
+        simd = run(0, ulaw, in, out, chn_num, round_num);
+        tbl = run(1, ulaw, in, out, chn_num, round_num);
+        printf("%s: g711.c %.1f ns/pkt, table %.1f ns/pkt, ratio %.2f\n",
+               ulaw ? "u-law" : "A-law", simd, tbl, simd / tbl);
+    }
+
+    free(ref);
+    free(out);
+    free(in);
+    return 0;
+}
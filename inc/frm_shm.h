@@ -0,0 +1,129 @@
+/*********************************************************************
+ * File Name    : frm_shm.h
+ * Description  : Layout of the shared memory frame ring of a channel
+ *                opened with CHN_FLAG_SHM, and the reader API used
+ *                by other processes to consume it without copying.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-03-05
+ ********************************************************************/
+
+#ifndef __FRM_SHM_H__
+#define __FRM_SHM_H__
+
+
+#if defined (__cplusplus) || defined (_cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define FRM_SHM_MAGIC       0x52465348  /* "HSFR" */
+#define FRM_SHM_VERSION     1
+#define FRM_SHM_ALIGN       32          /* records start at this alignment, a record header fits */
+#define FRM_SHM_TYPE_PAD    0           /* skip to the start of data area */
+
+/*
+ * Header at the start of the mapping, the data area follows it.
+ * There's one writer, which never waits for readers. Before bytes
+ * are overwritten, tail is moved past them, so a reader validates
+ * what it has read by checking tail hasn't passed its record.
+ * @data_off:   offset of data area from the start of the mapping.
+ * @data_sz:    size of data area, power of 2.
+ * @head:       bytes written, records end before it.
+ * @tail:       bytes before it may be overwritten.
+ * @last:       start of the newest record, where a reader falls behind resyncs.
+ * @seq:        frames published, a futex readers may wait on.
+ * Frame header room(frm_hdr_sz) isn't published.
+ */
+struct frm_shm_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t data_off;
+    uint32_t data_sz;
+    uint32_t seq;
+    uint32_t rsvd;
+    uint64_t head;
+    uint64_t tail;
+    uint64_t last;
+};
+
+/*
+ * One record in the data area, records never wrap around.
+ * @rec_sz:     size of the record, FRM_SHM_ALIGN aligned.
+ * @frm_type:   enum frm_type, FRM_SHM_TYPE_PAD for padding.
+ * @flags:      FRM_FLAG_XXX.
+ * @ts:         RTP timestamp.
+ * @frm_sz:     size of frame data following the record header.
+ * @nalu_num:   NALUs indexed(struct nalu_info) after frame data,
+ *              FRM_SHM_ALIGN aligned.
+ * @frm_no:     sequence number of the frame, from 1.
+ */
+struct frm_shm_rec {
+    uint32_t rec_sz;
+    uint32_t frm_type;
+    uint32_t flags;
+    uint32_t ts;
+    uint32_t frm_sz;
+    uint32_t nalu_num;
+    uint64_t frm_no;
+};
+
+/* reader of one channel, read-only mapping */
+struct frm_shm_reader {
+    const struct frm_shm_hdr *hdr;
+    const char *data;
+    uint64_t pos;               /* next record to read */
+    uint64_t map_sz;
+    uint64_t next_no;           /* frm_no expected next, 0 before the first */
+    uint64_t lost;              /* frames overwritten before being read */
+};
+
+/* frame referring to the mapping */
+struct frm_shm_frm {
+    uint32_t frm_type;
+    uint32_t flags;
+    uint32_t ts;
+    uint32_t frm_sz;
+    uint32_t nalu_num;
+    uint64_t frm_no;
+    const char *frm;                /* frame data */
+    const void *nalu;               /* struct nalu_info[nalu_num] */
+    uint64_t pos;                   /* used by frm_shm_valid() */
+};
+
+/**
+ * @breif: map the ring read-only, the fd is got by get_shm_fd() in
+ *         the process of library, and passed by SCM_RIGHTS or opened
+ *         as /proc/<pid>/fd/<fd>. It can be closed once mapped.
+ *         Reading starts from the newest frame.
+ */
+int open_frm_shm(struct frm_shm_reader *rp, int fd);
+void close_frm_shm(struct frm_shm_reader *rp);
+
+/**
+ * @breif: get the next frame without copying, frames overwritten
+ *         before being read are skipped and counted in lost.
+ *
+ * Return 1 if a frame is got, 0 if there isn't any.
+ */
+int read_frm_shm(struct frm_shm_reader *rp, struct frm_shm_frm *frmp);
+
+/**
+ * @breif: tests whether the frame got is still intact, call it
+ *         after using the frame data, or copy of it.
+ */
+int frm_shm_valid(const struct frm_shm_reader *rp, const struct frm_shm_frm *frmp);
+
+/**
+ * @breif: wait for new frames at most timeout(ms), -1 for ever.
+ *
+ * Return 1 if there're frames to read, 0 on timeout.
+ */
+int wait_frm_shm(struct frm_shm_reader *rp, int timeout);
+
+#if defined (__cplusplus) || defined (_cplusplus)
+}
+#endif
+
+
+#endif /* __FRM_SHM_H__ */
@@ -14,6 +14,8 @@ extern "C" {
 #endif
 
 #define MAX_FRM_SZ      (1024 * 1024) /* max frame size */
+#define MAX_AUD_FRM_SZ  (16 * 1024)   /* max audio frame size */
+#define MAX_NALU_NUM    256           /* max NALUs indexed in a frame */
 #define MAX_CHN_NUM     8             /* max channel number */
 #define DFL_RTSP_PORT   10554
 
@@ -27,6 +29,37 @@ enum frm_type {
     FRM_TYPE_AF,
 };
 
+/* flags of channel */
+#define CHN_FLAG_PIPELINE   0x01  /* send independent RTSP requests back to back */
+#define CHN_FLAG_PCM16      0x02  /* deliver G.711 audio as PCM16 in host byte order */
+#define CHN_FLAG_AVCC       0x04  /* 4 bytes NALU length instead of start code(AVCC/HVCC) */
+#define CHN_FLAG_SLICE      0x08  /* deliver video NALUs once completed, see FRM_FLAG_XXX */
+#define CHN_FLAG_AU_BOUNDARY 0x10 /* besides marker bit, end video frame on new timestamp,
+                                     AUD, parameter sets, SEI or first slice of picture */
+#define CHN_FLAG_PACING     0x20  /* pass frames on at the pace of RTP timestamps,
+                                     from a shared timer thread */
+#define CHN_FLAG_ASYNC      0x40  /* pass frames on from a pool of threads, frames of
+                                     a channel keep their order; implied by PACING */
+#define CHN_FLAG_PULL       0x80  /* frames are taken by get_frm() instead of callback */
+#define CHN_FLAG_BATCH      0x100 /* frames are passed on by store_frms_t callback in batches,
+                                     ignored with PACING or PULL */
+#define CHN_FLAG_SHM        0x200 /* also publish frames into a shared memory ring,
+                                     see get_shm_fd() and frm_shm.h */
+
+/* flags of frame */
+#define FRM_FLAG_START      0x01  /* first part of a frame */
+#define FRM_FLAG_END        0x02  /* last part of a frame */
+#define FRM_FLAG_NONREF     0x04  /* video frame not used for reference, safe to drop */
+#define FRM_FLAG_CACHED     0x08  /* frame from GOP cache, passed on when joining */
+
+/* decimation mode of video, frames are dropped before being assembled */
+enum decim_mode {
+    DECIM_NONE,                 /* keep all frames */
+    DECIM_KEY_ONLY,             /* keep IDR(H.264)/IRAP(H.265) frames */
+    DECIM_REF_ONLY,             /* drop non-reference frames */
+    DECIM_GOP,                  /* keep one of every decim_gop GOPs */
+};
+
 /* channel type */
 enum chn_type {
     CHN_TYPE_MAIN,
@@ -34,6 +67,21 @@ enum chn_type {
 };
 
 
+/*
+ * frames dropped by the delivery ring of a channel(CHN_FLAG_ASYNC
+ * or CHN_FLAG_PULL) when user falls behind:
+ * @nonref: non-reference video frames, dropped first.
+ * @ref:    reference video frames, and the rest of their GOPs.
+ * @key:    key frames, only when the ring is full.
+ * @audio:  audio frames, only when the ring is full.
+ */
+struct drop_stat {
+    unsigned int nonref;
+    unsigned int ref;
+    unsigned int key;
+    unsigned int audio;
+};
+
 /*
  * channel information:
  * @chn_no:     remote channel number.
@@ -41,18 +89,58 @@ enum chn_type {
  * @frm_hdr_sz: used to reserve some space for storing
  *              frame header in user level.
  * @usr_data:   store user data, may be used when nessary.
+ * @flags:      CHN_FLAG_XXX, zero for default behavior.
+ * @aud_intvl:  audio packets within this window(ms) are delivered
+ *              as one frame, 0 for delivering each packet.
+ *              It's limited by MAX_AUD_FRM_SZ.
+ * @decim_mode: decimation mode of video, see set_chn_decim().
+ * @decim_gop:  used with DECIM_GOP.
+ * @max_delay:  with CHN_FLAG_PACING, the delay(ms) added to absorb
+ *              jitter never exceeds it, 0 for default(200ms).
+ * @gop_cache_sz: memory budget(bytes) of frames kept from the last key
+ *              frame on, passed on to a channel joining the session
+ *              first(FRM_FLAG_CACHED), so it starts without waiting for
+ *              the next key frame. 0 for no cache. The budget of the
+ *              channel opening the session is used. Cached frames are
+ *              passed on by the thread calling open_chn(), or start_rec(),
+ *              before it returns, not paced nor by delivery threads.
  */
 struct chn_info {
     int local_chn;              /* local channel number */
     unsigned frm_hdr_sz;
     void *usr_data;
+    unsigned flags;
+    unsigned aud_intvl;
+    enum decim_mode decim_mode;
+    unsigned decim_gop;
+    unsigned max_delay;
+    unsigned gop_cache_sz;
+};
+
+/* NALU in a video frame */
+struct nalu_info {
+    unsigned off;               /* offset of NALU header in pure av data */
+    unsigned sz;                /* NALU size, start code excluded */
+    unsigned type;              /* NALU type of H.264 or H.265 */
 };
 
-/* frame information used for getting frame */
+/*
+ * frame information used for getting frame
+ * @nalu:       NALUs of video frame, in the order of the bitstream.
+ *              NULL for audio, or when the frame has more than
+ *              MAX_NALU_NUM NALUs.
+ * @flags:      FRM_FLAG_XXX, START & END both set unless CHN_FLAG_SLICE
+ *              is used, then a video frame may come in several parts.
+ * New members are only added at the end.
+ */
 struct frm_info {
     char *frm_buf;              /* frame buffer: store pure av data */
     unsigned frm_sz;        /* frame size */
     enum frm_type frm_type;     /* frame type */
+    struct nalu_info *nalu;
+    unsigned nalu_num;
+    unsigned flags;
+    unsigned ts;                /* RTP timestamp */
 };
 
 /**
@@ -65,13 +153,20 @@ struct frm_info {
  *
  * @chnp:       channel information
  *              
+ * Channels of the same URI and transport, with the same channel
+ * information except usr_data and local_chn, share one RTSP session,
+ * each frame is passed on to all of them. It's not shared in pull mode.
+ * The callback mustn't open or close channels of the stream it serves.
+ *
  * Return one user ID when we start thread for opening
  * remote channel successfully, return zero when failed.
  */
 unsigned long open_chn(char *uri, struct chn_info *chnp, int intlvd);
 
 /**
- * @breif: stop thread and free resource for opening remote channel.
+ * @breif: stop thread and free resource for opening remote channel,
+ *         the RTSP session is torn down when the last channel sharing
+ *         it is closed.
  *
  * @usr_id: the value returned by open_chn().
  */
@@ -85,12 +180,141 @@ void close_chn(unsigned long usr_id);
  */
 int chn_playing(unsigned long usr_id);
 
+/**
+ * @breif: change the decimation mode of video at runtime,
+ *         it takes effect from the next frame. It fails when other
+ *         channels, or a recorder, share the session of the channel.
+ *
+ * @usr_id: the value returned by open_chn().
+ * @gop:    with DECIM_GOP, keep one of every gop GOPs.
+ */
+int set_chn_decim(unsigned long usr_id, enum decim_mode mode, unsigned gop);
+
+/**
+ * @breif: get the decoder configuration record(avcC for H.264,
+ *         hvcC for H.265) built from parameter sets in SDP,
+ *         NALU length is 4 bytes as CHN_FLAG_AVCC.
+ *         It's ready once chn_playing() returns 1.
+ *
+ * @usr_id: the value returned by open_chn().
+ *
+ * Return the record size, -1 if it's unavailable or buf is too small.
+ */
+int get_codec_cfg(unsigned long usr_id, char *buf, unsigned int sz);
+
+/**
+ * @breif: get the memfd of the shared memory frame ring of a channel
+ *         opened with CHN_FLAG_SHM, for reader processes, see frm_shm.h.
+ *         Don't close it.
+ *
+ * @usr_id: the value returned by open_chn().
+ */
+int get_shm_fd(unsigned long usr_id);
+
+/**
+ * @breif: set the number of threads passing frames on for
+ *         channels opened with CHN_FLAG_ASYNC, 2 by default.
+ *         It must be called before such a channel is opened.
+ *
+ * @num: 1 ~ 32.
+ */
+int set_deliver_thrd_num(unsigned int num);
+
+/**
+ * @breif: get frames dropped by the delivery ring of a channel
+ *         opened with CHN_FLAG_ASYNC or CHN_FLAG_PULL.
+ *
+ * @usr_id: the value returned by open_chn().
+ */
+int get_drop_stat(unsigned long usr_id, struct drop_stat *statp);
+
+/**
+ * @breif: get the eventfd of a channel opened with CHN_FLAG_PULL,
+ *         it becomes readable when frames are ready. Read it to
+ *         clear it, then call get_frm() until it returns less
+ *         than asked. Don't close it.
+ *
+ * @usr_id: the value returned by open_chn().
+ */
+int get_frm_fd(unsigned long usr_id);
+
+/**
+ * @breif: let a channel opened with CHN_FLAG_PULL signal the eventfd
+ *         given instead of its own, so a group of channels can share
+ *         one fd. The fd is owned by user, -1 restores the channel's own.
+ *
+ * @usr_id: the value returned by open_chn().
+ */
+int set_frm_fd(unsigned long usr_id, int fd);
+
+/**
+ * @breif: take frames of a channel opened with CHN_FLAG_PULL, without
+ *         blocking. Frames are kept until released by release_frm(),
+ *         even after the channel is closed. Don't call it for one
+ *         channel from more than one thread at the same time.
+ *
+ * @usr_id: the value returned by open_chn().
+ * @frms:   filled with at most num frames, in order.
+ *
+ * Return the number of frames taken, -1 on error.
+ */
+int get_frm(unsigned long usr_id, struct frm_info *frms, unsigned int num);
+
+/**
+ * @breif: release frames taken by get_frm().
+ */
+void release_frm(struct frm_info *frms, unsigned int num);
+
 /**
  * @breif: we will call this callback function when prepare one
  *         completed frame(just pure av data without frame header).
  */
 typedef int (*store_frm_t)(struct chn_info *chnp, struct frm_info *frmp);
 
+/* one frame in a batch */
+struct chn_frm {
+    struct chn_info *chnp;
+    struct frm_info *frmp;
+};
+
+/**
+ * @breif: we will call this callback function with the frames completed
+ *         by one iteration of the event loop, of channels opened with
+ *         CHN_FLAG_BATCH. Frames of several channels may come in one batch
+ *         with CHN_FLAG_ASYNC, frames of a channel are always in order.
+ *         Frames are freed once it returns.
+ */
+typedef int (*store_frms_t)(struct chn_frm *frms, unsigned int num);
+
+/**
+ * @breif: set the batch callback, store_frm_t is used if it isn't set.
+ */
+int set_store_frms(store_frms_t store_frms);
+
+/**
+ * @breif: record video of a channel into a fragmented MP4 file,
+ *         one fragment per GOP, starting from a key frame(from
+ *         the GOP cache if there's one). The file is written
+ *         in large aligned blocks with O_DIRECT by threads shared
+ *         by all recorders, and preallocated in chunks. If the
+ *         disk falls behind, fragments are dropped rather than
+ *         stalling the channel. Audio isn't recorded.
+ *         The session is kept till the recording stops, even if
+ *         the channel is closed. Not for channels in pull mode.
+ *
+ * @usr_id: the value returned by open_chn().
+ *
+ * Return recorder ID, zero when failed.
+ */
+unsigned long start_rec(unsigned long usr_id, const char *path);
+
+/**
+ * @breif: finish the file and free the recorder.
+ *
+ * @rec_id: the value returned by start_rec().
+ */
+void stop_rec(unsigned long rec_id);
+
 int init_rtsp_cli(store_frm_t store_frm);
 void deinit_rtsp_cli(void);
 
@@ -0,0 +1,122 @@
+/*********************************************************************
+ * File Name    : arena.c
+ * Description  : Arena allocator for objects living only while
+ *                one RTSP message is handled.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-01-08
+ ********************************************************************/
+
+#include "log.h"
+#include "util.h"
+#include "list.h"
+#include "arena.h"
+
+
+#define ARENA_ALIGN     sizeof(long long)
+
+
+static struct arena_chunk *alloc_arena_chunk(unsigned int sz)
+{
+    struct arena_chunk *chunkp = NULL;
+
+    chunkp = malloc(sizeof(*chunkp) + sz);
+    if (!chunkp) {
+        printd(ERR "Allocate memory for arena chunk failed!\n");
+        return NULL;
+    }
+    chunkp->sz = sz;
+    chunkp->used = 0;
+    return chunkp;
+}
+
+int init_arena(struct arena *ap, unsigned int chunk_sz)
+{
+    struct arena_chunk *chunkp = NULL;
+
+    INIT_LIST_HEAD(&ap->chunk_list);
+    ap->chunk_sz = chunk_sz;
+
+    /* The first chunk is kept until the arena is de-initialized. */
+    chunkp = alloc_arena_chunk(chunk_sz);
+    if (!chunkp) {
+        return -1;
+    }
+    list_add_tail(&chunkp->entry, &ap->chunk_list);
+    return 0;
+}
+
+void deinit_arena(struct arena *ap)
+{
+    struct arena_chunk *chunkp = NULL;
+    struct arena_chunk *tmp = NULL;
+
+    list_for_each_entry_safe(chunkp, tmp, &ap->chunk_list, entry) {
+        list_del(&chunkp->entry);
+        freez(chunkp);
+    }
+    return;
+}
+
+/**
+ * Give back all memory allocated from the arena,
+ * only the first chunk is kept for next use.
+ */
+void reset_arena(struct arena *ap)
+{
+    struct arena_chunk *chunkp = NULL;
+    struct arena_chunk *tmp = NULL;
+
+    list_for_each_entry_safe(chunkp, tmp, &ap->chunk_list, entry) {
+        if (chunkp->entry.prev == &ap->chunk_list) {
+            chunkp->used = 0;
+            continue;
+        }
+        list_del(&chunkp->entry);
+        freez(chunkp);
+    }
+    return;
+}
+
+/**
+ * Allocate zeroed memory from the arena.
+ * Add one more chunk if the last one hasn't enough space.
+ */
+void *alloc_from_arena(struct arena *ap, unsigned int sz)
+{
+    struct arena_chunk *chunkp = NULL;
+    void *ptr = NULL;
+
+    sz = (sz + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if (!list_empty(&ap->chunk_list)) {
+        chunkp = list_entry(ap->chunk_list.prev, struct arena_chunk, entry);
+    }
+    if (!chunkp || chunkp->sz - chunkp->used < sz) {
+        chunkp = alloc_arena_chunk(sz > ap->chunk_sz ? sz : ap->chunk_sz);
+        if (!chunkp) {
+            return NULL;
+        }
+        list_add_tail(&chunkp->entry, &ap->chunk_list);
+    }
+
+    ptr = chunkp->data + chunkp->used;
+    chunkp->used += sz;
+    memset(ptr, 0, sz);
+    return ptr;
+}
+
+/**
+ * Copy @len characters of @str into the arena,
+ * the copy is terminated by '\0'.
+ */
+char *dup_str_to_arena(struct arena *ap, const char *str, unsigned int len)
+{
+    char *dup = NULL;
+
+    dup = alloc_from_arena(ap, len + 1);
+    if (dup) {
+        memcpy(dup, str, len);
+        dup[len] = '\0';
+    }
+    return dup;
+}
@@ -0,0 +1,42 @@
+/*********************************************************************
+ * File Name    : arena.h
+ * Description  : Arena allocator for objects living only while
+ *                one RTSP message is handled.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-01-08
+ ********************************************************************/
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+
+#include "list.h"
+
+#define ARENA_CHUNK_SZ  (8 * 1024)  /* default size of one chunk */
+
+/* Memory is taken from chunks linked in the arena. */
+struct arena_chunk {
+    struct list_head entry;     /* entry of chunk list */
+    unsigned int sz;            /* size of data[] */
+    unsigned int used;          /* bytes used in data[] */
+    char data[0];
+};
+
+/*
+ * Objects allocated from an arena are never freed one by one,
+ * reset_arena() gives back all of them in bulk.
+ */
+struct arena {
+    struct list_head chunk_list;
+    unsigned int chunk_sz;
+};
+
+int init_arena(struct arena *ap, unsigned int chunk_sz);
+void deinit_arena(struct arena *ap);
+void reset_arena(struct arena *ap);
+
+void *alloc_from_arena(struct arena *ap, unsigned int sz);
+char *dup_str_to_arena(struct arena *ap, const char *str, unsigned int len);
+
+
+#endif /* __ARENA_H__ */
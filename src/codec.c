@@ -0,0 +1,47 @@
+/*********************************************************************
+ * File Name    : codec.c
+ * Description  : Registry of codecs we can depacketize.
+ *                To support a new codec, add its depacketizer here.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-02-20
+ ********************************************************************/
+
+#include <stddef.h>
+#include <strings.h>
+#include "codec.h"
+
+
+static const struct codec codec_tbl[] = {
+    {"H264", -1,          MEDIA_TYPE_VIDEO, VIDEO_CODEC_H264, VIDEO_CLK_RATE, depack_h264},
+    {"H265", -1,          MEDIA_TYPE_VIDEO, VIDEO_CODEC_H265, VIDEO_CLK_RATE, depack_h265},
+    {"HEVC", -1,          MEDIA_TYPE_VIDEO, VIDEO_CODEC_H265, VIDEO_CLK_RATE, depack_h265},
+    {"PCMU", RTP_PT_PCMU, MEDIA_TYPE_AUDIO, 0,                G711_CLK_RATE,  depack_g711},
+    {"PCMA", RTP_PT_PCMA, MEDIA_TYPE_AUDIO, 0,                G711_CLK_RATE,  depack_g711},
+};
+
+const struct codec *find_codec_by_name(const char *enc_name)
+{
+    unsigned int i = 0;
+
+    if (!enc_name) {
+        return NULL;
+    }
+    for (i = 0; i < sizeof(codec_tbl) / sizeof(codec_tbl[0]); i++) {
+        if (!strcasecmp(codec_tbl[i].enc_name, enc_name)) {
+            return &codec_tbl[i];
+        }
+    }
+    return NULL;
+}
+
+const struct codec *find_codec_by_pt(unsigned int pt)
+{
+    unsigned int i = 0;
+
+    for (i = 0; i < sizeof(codec_tbl) / sizeof(codec_tbl[0]); i++) {
+        if (codec_tbl[i].static_pt == (int)pt) {
+            return &codec_tbl[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,36 @@
+/*********************************************************************
+ * File Name    : codec.h
+ * Description  : Registry of codecs we can depacketize.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-02-20
+ ********************************************************************/
+
+#ifndef __CODEC_H__
+#define __CODEC_H__
+
+#include "rtp.h"
+
+
+/*
+ * codec information:
+ * @enc_name:       encoding name in `a=rtpmap'.
+ * @static_pt:      static payload type of RFC 3551, -1 if dynamic.
+ * @media:          media type.
+ * @video_codec:    used by NALU handling, only for video.
+ * @clk_rate:       used when `a=rtpmap' is absent.
+ * @depack:         depacketizer.
+ */
+struct codec {
+    const char *enc_name;
+    int static_pt;
+    enum media_type media;
+    enum video_codec video_codec;
+    unsigned int clk_rate;
+    depack_t depack;
+};
+
+const struct codec *find_codec_by_name(const char *enc_name);
+const struct codec *find_codec_by_pt(unsigned int pt);
+
+
+#endif /* __CODEC_H__ */
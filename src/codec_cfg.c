@@ -0,0 +1,469 @@
+/*********************************************************************
+ * File Name    : codec_cfg.c
+ * Description  : Build decoder configuration record(avcC/hvcC)
+ *                from parameter sets, ISO/IEC 14496-15.
+ *                Only the leading fields of SPS are parsed,
+ *                up to the picture size.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-02-22
+ ********************************************************************/
+
+#include <string.h>
+#include "codec_cfg.h"
+#include "log.h"
+
+
+#define MAX_RBSP_SZ 256         /* enough for the SPS fields we need */
+
+/* reader of RBSP, emulation prevention bytes removed */
+struct bit_reader {
+    unsigned char buf[MAX_RBSP_SZ];
+    unsigned int sz;
+    unsigned int pos;           /* in bits */
+    int err;                    /* read beyond the end */
+};
+
+static void init_bit_reader(struct bit_reader *brp, const char *nalu,
+                            unsigned int sz, unsigned int hdr_sz)
+{
+    const unsigned char *ptr = (const unsigned char *)nalu;
+    unsigned int zeros = 0;
+    unsigned int i = 0;
+
+    memset(brp, 0, sizeof(*brp));
+    for (i = hdr_sz; i < sz && brp->sz < sizeof(brp->buf); i++) {
+        if (zeros >= 2 && ptr[i] == 0x03) {
+            zeros = 0;
+            continue;
+        }
+        zeros = ptr[i] ? 0 : zeros + 1;
+        brp->buf[brp->sz++] = ptr[i];
+    }
+    return;
+}
+
+static unsigned int read_bits(struct bit_reader *brp, unsigned int n)
+{
+    unsigned int val = 0;
+
+    while (n--) {
+        if (brp->pos >= brp->sz * 8) {
+            brp->err = 1;
+            return 0;
+        }
+        val = (val << 1) | ((brp->buf[brp->pos / 8] >> (7 - brp->pos % 8)) & 0x01);
+        brp->pos++;
+    }
+    return val;
+}
+
+/* Exp-Golomb code */
+static unsigned int read_ue(struct bit_reader *brp)
+{
+    unsigned int zeros = 0;
+
+    while (!read_bits(brp, 1)) {
+        if (brp->err || ++zeros > 31) {
+            brp->err = 1;
+            return 0;
+        }
+    }
+    return ((1U << zeros) - 1) + read_bits(brp, zeros);
+}
+
+static int read_se(struct bit_reader *brp)
+{
+    unsigned int val = read_ue(brp);
+
+    return (val & 0x01) ? (int)((val + 1) / 2) : -(int)(val / 2);
+}
+
+/* fields of SPS we need */
+struct sps_info {
+    unsigned int profile;           /* H.264 */
+    unsigned int compat;            /* H.264 */
+    unsigned int level;             /* H.264 */
+    int high;                       /* H.264, fields of high profiles present */
+    unsigned char ptl[12];          /* H.265, general profile, tier & level */
+    unsigned int sub_layers;        /* H.265 */
+    unsigned int nesting;           /* H.265 */
+    unsigned int chroma_format;
+    unsigned int luma_depth;
+    unsigned int chroma_depth;
+    unsigned int width;             /* 0 if it isn't parsed */
+    unsigned int height;
+};
+
+static unsigned char *put_u16(unsigned char *ptr, unsigned int val)
+{
+    *ptr++ = (val >> 8) & 0xFF;
+    *ptr++ = val & 0xFF;
+    return ptr;
+}
+
+static unsigned int get_ps_type(enum video_codec codec, const char *nalu)
+{
+    if (codec == VIDEO_CODEC_H265) {
+        return (nalu[0] >> 1) & 0x3F;
+    }
+    return nalu[0] & 0x1F;
+}
+
+/**
+ * Size of parameter sets of NALU type, and how many.
+ */
+static unsigned int get_ps_sz(enum video_codec codec, const struct param_sets *psp,
+                              unsigned int type, unsigned int *num)
+{
+    unsigned int sz = 0;
+    unsigned int i = 0;
+    const char *nalu = NULL;
+
+    *num = 0;
+    for (i = 0; i < psp->num; i++) {
+        nalu = psp->buf + psp->nalu[i].off;
+        if (get_ps_type(codec, nalu) == type) {
+            sz += 2 + psp->nalu[i].sz;
+            (*num)++;
+        }
+    }
+    return sz;
+}
+
+/**
+ * Put parameter sets of NALU type, each with 16 bits length.
+ */
+static unsigned char *put_ps(unsigned char *ptr, enum video_codec codec,
+                             const struct param_sets *psp, unsigned int type)
+{
+    unsigned int i = 0;
+    const char *nalu = NULL;
+
+    for (i = 0; i < psp->num; i++) {
+        nalu = psp->buf + psp->nalu[i].off;
+        if (get_ps_type(codec, nalu) == type) {
+            ptr = put_u16(ptr, psp->nalu[i].sz);
+            memcpy(ptr, nalu, psp->nalu[i].sz);
+            ptr += psp->nalu[i].sz;
+        }
+    }
+    return ptr;
+}
+
+/**
+ * Find the first parameter set of NALU type.
+ */
+static int find_ps(enum video_codec codec, const struct param_sets *psp,
+                   unsigned int type)
+{
+    unsigned int i = 0;
+    const char *nalu = NULL;
+
+    for (i = 0; i < psp->num; i++) {
+        nalu = psp->buf + psp->nalu[i].off;
+        if (get_ps_type(codec, nalu) == type) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Parse the first SPS of H.264, the picture size is left 0
+ * if the SPS is cut short after the fields of avcC.
+ */
+static int parse_avc_sps(const struct param_sets *psp, struct sps_info *infop)
+{
+    struct bit_reader br;
+    unsigned int crop[4] = {0};
+    unsigned int crop_x = 1;
+    unsigned int crop_y = 1;
+    unsigned int mbs_only = 0;
+    unsigned int w = 0;
+    unsigned int h = 0;
+    unsigned int n = 0;
+    unsigned int last = 0;
+    unsigned int i = 0;
+    unsigned int j = 0;
+    int k = 0;
+
+    memset(infop, 0, sizeof(*infop));
+    infop->chroma_format = 1;
+    k = find_ps(VIDEO_CODEC_H264, psp, NALU_TYPE_SPS);
+    if (k < 0) {
+        return -1;
+    }
+    init_bit_reader(&br, psp->buf + psp->nalu[k].off, psp->nalu[k].sz, 1);
+    infop->profile = read_bits(&br, 8);
+    infop->compat = read_bits(&br, 8);
+    infop->level = read_bits(&br, 8);
+    read_ue(&br);               /* seq_parameter_set_id */
+    switch (infop->profile) {
+    case 100: case 110: case 122: case 244: case 44:
+    case 83: case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+        infop->high = 1;
+        infop->chroma_format = read_ue(&br);
+        if (infop->chroma_format == 3) {
+            read_bits(&br, 1);  /* separate_colour_plane_flag */
+        }
+        infop->luma_depth = read_ue(&br);
+        infop->chroma_depth = read_ue(&br);
+        read_bits(&br, 1);      /* qpprime_y_zero_transform_bypass_flag */
+        if (read_bits(&br, 1)) {    /* seq_scaling_matrix_present_flag */
+            n = infop->chroma_format == 3 ? 12 : 8;
+            for (i = 0; i < n; i++) {
+                if (!read_bits(&br, 1)) {
+                    continue;
+                }
+                last = 8;
+                for (j = 0; j < (i < 6 ? 16U : 64U) && last; j++) {
+                    last = (last + read_se(&br) + 256) % 256;
+                }
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    if (br.err) {
+        printd(WARNING "SPS is too short!\n");
+        return -1;
+    }
+
+    read_ue(&br);               /* log2_max_frame_num_minus4 */
+    switch (read_ue(&br)) {     /* pic_order_cnt_type */
+    case 0:
+        read_ue(&br);           /* log2_max_pic_order_cnt_lsb_minus4 */
+        break;
+    case 1:
+        read_bits(&br, 1);      /* delta_pic_order_always_zero_flag */
+        read_se(&br);
+        read_se(&br);
+        n = read_ue(&br);
+        for (i = 0; i < n && !br.err; i++) {
+            read_se(&br);
+        }
+        break;
+    default:
+        break;
+    }
+    read_ue(&br);               /* max_num_ref_frames */
+    read_bits(&br, 1);          /* gaps_in_frame_num_value_allowed_flag */
+    w = read_ue(&br) + 1;
+    h = read_ue(&br) + 1;
+    mbs_only = read_bits(&br, 1);
+    if (!mbs_only) {
+        read_bits(&br, 1);      /* mb_adaptive_frame_field_flag */
+    }
+    read_bits(&br, 1);          /* direct_8x8_inference_flag */
+    if (read_bits(&br, 1)) {    /* frame_cropping_flag */
+        for (i = 0; i < 4; i++) {
+            crop[i] = read_ue(&br);
+        }
+    }
+    if (!br.err) {
+        if (infop->chroma_format == 1 || infop->chroma_format == 2) {
+            crop_x = 2;
+        }
+        crop_y = (infop->chroma_format == 1 ? 2 : 1) * (2 - mbs_only);
+        infop->width = w * 16 - crop_x * (crop[0] + crop[1]);
+        infop->height = (2 - mbs_only) * h * 16 - crop_y * (crop[2] + crop[3]);
+    }
+    return 0;
+}
+
+/**
+ * Parse the first SPS of H.265.
+ */
+static int parse_hevc_sps(const struct param_sets *psp, struct sps_info *infop)
+{
+    struct bit_reader br;
+    unsigned int sub_profile = 0;
+    unsigned int sub_level = 0;
+    unsigned int crop[4] = {0};
+    unsigned int w = 0;
+    unsigned int h = 0;
+    unsigned int i = 0;
+    int j = 0;
+
+    memset(infop, 0, sizeof(*infop));
+    j = find_ps(VIDEO_CODEC_H265, psp, HEVC_NALU_TYPE_SPS);
+    if (j < 0) {
+        return -1;
+    }
+    init_bit_reader(&br, psp->buf + psp->nalu[j].off, psp->nalu[j].sz, 2);
+    read_bits(&br, 4);          /* sps_video_parameter_set_id */
+    infop->sub_layers = read_bits(&br, 3);
+    infop->nesting = read_bits(&br, 1);
+    for (i = 0; i < sizeof(infop->ptl); i++) {
+        infop->ptl[i] = read_bits(&br, 8);
+    }
+    for (i = 0; i < infop->sub_layers; i++) {
+        sub_profile |= read_bits(&br, 1) << i;
+        sub_level |= read_bits(&br, 1) << i;
+    }
+    if (infop->sub_layers) {
+        read_bits(&br, 2 * (8 - infop->sub_layers));   /* reserved_zero_2bits */
+    }
+    for (i = 0; i < infop->sub_layers; i++) {
+        if (sub_profile & (1 << i)) {
+            read_bits(&br, 32);
+            read_bits(&br, 32);
+            read_bits(&br, 24);
+        }
+        if (sub_level & (1 << i)) {
+            read_bits(&br, 8);
+        }
+    }
+    read_ue(&br);               /* sps_seq_parameter_set_id */
+    infop->chroma_format = read_ue(&br);
+    if (infop->chroma_format == 3) {
+        read_bits(&br, 1);      /* separate_colour_plane_flag */
+    }
+    w = read_ue(&br);           /* pic_width_in_luma_samples */
+    h = read_ue(&br);           /* pic_height_in_luma_samples */
+    if (read_bits(&br, 1)) {    /* conformance_window_flag */
+        for (i = 0; i < 4; i++) {
+            crop[i] = read_ue(&br);
+        }
+    }
+    infop->luma_depth = read_ue(&br);
+    infop->chroma_depth = read_ue(&br);
+    if (br.err) {
+        printd(WARNING "SPS is too short!\n");
+        return -1;
+    }
+
+    /* SubWidthC & SubHeightC */
+    infop->width = w - (infop->chroma_format == 1 || infop->chroma_format == 2 ? 2 : 1) *
+        (crop[0] + crop[1]);
+    infop->height = h - (infop->chroma_format == 1 ? 2 : 1) * (crop[2] + crop[3]);
+    return 0;
+}
+
+/**
+ * AVCDecoderConfigurationRecord
+ */
+static int build_avcc(const struct param_sets *psp, unsigned char *buf, unsigned int sz)
+{
+    struct sps_info info;
+    unsigned int sps_num = 0;
+    unsigned int pps_num = 0;
+    unsigned int total = 0;
+    unsigned char *ptr = buf;
+
+    if (parse_avc_sps(psp, &info) < 0) {
+        return -1;
+    }
+
+    total = 6 + get_ps_sz(VIDEO_CODEC_H264, psp, NALU_TYPE_SPS, &sps_num) +
+        1 + get_ps_sz(VIDEO_CODEC_H264, psp, NALU_TYPE_PPS, &pps_num) + (info.high ? 4 : 0);
+    if (total > sz || sps_num > 31 || pps_num > 255) {
+        return -1;
+    }
+
+    *ptr++ = 1;                 /* configurationVersion */
+    *ptr++ = info.profile;
+    *ptr++ = info.compat;
+    *ptr++ = info.level;
+    *ptr++ = 0xFC | (NALU_LEN_SZ - 1);
+    *ptr++ = 0xE0 | sps_num;
+    ptr = put_ps(ptr, VIDEO_CODEC_H264, psp, NALU_TYPE_SPS);
+    *ptr++ = pps_num;
+    ptr = put_ps(ptr, VIDEO_CODEC_H264, psp, NALU_TYPE_PPS);
+    if (info.high) {
+        *ptr++ = 0xFC | (info.chroma_format & 0x03);
+        *ptr++ = 0xF8 | (info.luma_depth & 0x07);
+        *ptr++ = 0xF8 | (info.chroma_depth & 0x07);
+        *ptr++ = 0;             /* numOfSequenceParameterSetExt */
+    }
+    return ptr - buf;
+}
+
+/**
+ * HEVCDecoderConfigurationRecord
+ */
+static int build_hvcc(const struct param_sets *psp, unsigned char *buf, unsigned int sz)
+{
+    static const unsigned int types[] = {
+        HEVC_NALU_TYPE_VPS, HEVC_NALU_TYPE_SPS, HEVC_NALU_TYPE_PPS,
+    };
+    struct sps_info info;
+    unsigned int num[3];
+    unsigned int arrays = 0;
+    unsigned int total = 0;
+    unsigned int i = 0;
+    unsigned char *ptr = buf;
+
+    if (parse_hevc_sps(psp, &info) < 0) {
+        return -1;
+    }
+
+    total = 23;
+    for (i = 0; i < 3; i++) {
+        total += get_ps_sz(VIDEO_CODEC_H265, psp, types[i], &num[i]);
+        if (num[i]) {
+            total += 3;
+            arrays++;
+        }
+    }
+    if (total > sz) {
+        return -1;
+    }
+
+    *ptr++ = 1;                 /* configurationVersion */
+    memcpy(ptr, info.ptl, 11);  /* profile_space ... constraint_indicator_flags */
+    ptr += 11;
+    *ptr++ = info.ptl[11];      /* general_level_idc */
+    ptr = put_u16(ptr, 0xF000); /* min_spatial_segmentation_idc */
+    *ptr++ = 0xFC;              /* parallelismType */
+    *ptr++ = 0xFC | (info.chroma_format & 0x03);
+    *ptr++ = 0xF8 | (info.luma_depth & 0x07);
+    *ptr++ = 0xF8 | (info.chroma_depth & 0x07);
+    ptr = put_u16(ptr, 0);      /* avgFrameRate */
+    *ptr++ = ((info.sub_layers + 1) << 3) | (info.nesting << 2) | (NALU_LEN_SZ - 1);
+    *ptr++ = arrays;
+    for (i = 0; i < 3; i++) {
+        if (!num[i]) {
+            continue;
+        }
+        *ptr++ = 0x80 | types[i];   /* array_completeness */
+        ptr = put_u16(ptr, num[i]);
+        ptr = put_ps(ptr, VIDEO_CODEC_H265, psp, types[i]);
+    }
+    return ptr - buf;
+}
+
+/**
+ * Return size of the record, -1 if there's no SPS or buf is too small.
+ */
+int build_codec_cfg(enum video_codec codec, const struct param_sets *psp,
+                    char *buf, unsigned int sz)
+{
+    if (codec == VIDEO_CODEC_H265) {
+        return build_hvcc(psp, (unsigned char *)buf, sz);
+    }
+    return build_avcc(psp, (unsigned char *)buf, sz);
+}
+
+/**
+ * Get the picture size from SPS, cropping applied.
+ */
+int get_pic_size(enum video_codec codec, const struct param_sets *psp,
+                 unsigned int *widthp, unsigned int *heightp)
+{
+    struct sps_info info;
+    int ret = 0;
+
+    if (codec == VIDEO_CODEC_H265) {
+        ret = parse_hevc_sps(psp, &info);
+    } else {
+        ret = parse_avc_sps(psp, &info);
+    }
+    if (ret < 0 || !info.width || !info.height) {
+        return -1;
+    }
+    *widthp = info.width;
+    *heightp = info.height;
+    return 0;
+}
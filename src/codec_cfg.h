@@ -0,0 +1,24 @@
+/*********************************************************************
+ * File Name    : codec_cfg.h
+ * Description  : Build decoder configuration record(avcC/hvcC)
+ *                from parameter sets.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-02-22
+ ********************************************************************/
+
+#ifndef __CODEC_CFG_H__
+#define __CODEC_CFG_H__
+
+#include "rtp.h"
+
+
+#define NALU_LEN_SZ         4   /* size of NALU length prefix in AVCC/HVCC mode */
+#define MAX_CODEC_CFG_SZ    (MAX_PARAM_SETS_SZ + 64)
+
+int build_codec_cfg(enum video_codec codec, const struct param_sets *psp,
+                    char *buf, unsigned int sz);
+int get_pic_size(enum video_codec codec, const struct param_sets *psp,
+                 unsigned int *widthp, unsigned int *heightp);
+
+
+#endif /* __CODEC_CFG_H__ */
@@ -0,0 +1,481 @@
+/*********************************************************************
+ * File Name    : deliver.c
+ * Description  : Pass frames on to user from a pool of threads,
+ *                out of the session thread.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-03-01
+ ********************************************************************/
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "log.h"
+#include "util.h"
+#include "rtsp_cli.h"
+#include "deliver.h"
+
+
+#define ALIGN8(sz)  (((sz) + 7) & ~7U)
+
+/**
+ * Copy the frame with its header room and NALU index.
+ */
+struct frm_copy *copy_frm(struct rtsp_sess *sessp, const struct frm_info *frmp)
+{
+    struct frm_copy *cp = NULL;
+    unsigned int data_sz = ALIGN8(sessp->chn_info.frm_hdr_sz + frmp->frm_sz);
+
+    cp = mallocz(sizeof(*cp) + data_sz + frmp->nalu_num * sizeof(struct nalu_info));
+    if (!cp) {
+        printd(ERR "Allocate memory for frame copy failed!\n");
+        return NULL;
+    }
+    cp->sessp = sessp;
+    cp->frm_info = *frmp;
+    cp->frm_info.frm_buf = cp->data;
+    memcpy(cp->data, frmp->frm_buf, sessp->chn_info.frm_hdr_sz + frmp->frm_sz);
+    if (frmp->nalu) {
+        cp->frm_info.nalu = (struct nalu_info *)(cp->data + data_sz);
+        memcpy(cp->frm_info.nalu, frmp->nalu, frmp->nalu_num * sizeof(struct nalu_info));
+    }
+    return cp;
+}
+
+/**
+ * Take one frame from the ring, by its only consumer.
+ */
+struct frm_copy *pop_deliver_ring(struct deliver_ring *ringp)
+{
+    struct frm_copy *cp = NULL;
+    unsigned int tail = ringp->tail;
+
+    if (tail == __atomic_load_n(&ringp->head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    cp = ringp->slot[tail & (DELIVER_RING_SZ - 1)];
+    __atomic_store_n(&ringp->tail, tail + 1, __ATOMIC_RELEASE);
+    return cp;
+}
+
+/**
+ * Pass the frames in batch on by one call, and free them.
+ * A frame goes to every channel sharing its session, so it may take
+ * more than one call. Channels are kept by holding sub_mutex of their
+ * sessions till the end, a session is only batched by one thread,
+ * its own or the deliver thread its ring is bound to.
+ */
+void flush_frm_batch(struct frm_batch *bp)
+{
+    struct rtsp_sess *locked[MAX_BATCH_NUM];
+    struct rtsp_sess *sessp = NULL;
+    struct rtsp_sub *subp = NULL;
+    unsigned int lock_num = 0;
+    unsigned int num = 0;
+    unsigned int i = 0;
+    unsigned int j = 0;
+
+    if (!bp->num) {
+        return;
+    }
+
+    for (i = 0; i < bp->num; i++) {
+        sessp = bp->frm[i]->sessp;
+        for (j = 0; j < lock_num && locked[j] != sessp; j++) {
+            ;
+        }
+        if (j == lock_num) {
+            pthread_mutex_lock(&sessp->sub_mutex);
+            locked[lock_num++] = sessp;
+        }
+        cache_gop_frm(sessp, &bp->frm[i]->frm_info);
+
+        list_for_each_entry(subp, &sessp->sub_list, entry) {
+            if (subp->recp) {
+                put_rec_frm(subp->recp, &bp->frm[i]->frm_info);
+                continue;
+            }
+            bp->chn_frm[num].chnp = &subp->chn_info;
+            bp->chn_frm[num].frmp = &bp->frm[i]->frm_info;
+            if (++num == MAX_BATCH_NUM) {
+                rtsp_cli.store_frms(bp->chn_frm, num);
+                num = 0;
+            }
+        }
+    }
+    if (num) {
+        rtsp_cli.store_frms(bp->chn_frm, num);
+    }
+    for (j = 0; j < lock_num; j++) {
+        pthread_mutex_unlock(&locked[j]->sub_mutex);
+    }
+
+    for (i = 0; i < bp->num; i++) {
+        freez(bp->frm[i]);
+    }
+    bp->num = 0;
+    return;
+}
+
+/**
+ * Add the frame copy to batch, flushed if it's full.
+ */
+void add_frm_batch(struct frm_batch *bp, struct frm_copy *cp)
+{
+    bp->frm[bp->num++] = cp;
+    if (bp->num == MAX_BATCH_NUM) {
+        flush_frm_batch(bp);
+    }
+    return;
+}
+
+/**
+ * Pass the frame copy on by callback of its channel.
+ */
+static void pass_frm_copy(struct frm_batch *bp, struct frm_copy *cp)
+{
+    if ((cp->sessp->chn_info.flags & CHN_FLAG_BATCH) && rtsp_cli.store_frms) {
+        add_frm_batch(bp, cp);
+        return;
+    }
+    store_sess_frm(cp->sessp, &cp->frm_info);
+    freez(cp);
+    return;
+}
+
+/**
+ * Take one frame from the rings of the thread, the ring
+ * served is moved to the tail, so channels take turns.
+ * Must be called with thrdp->mutex held.
+ */
+static struct frm_copy *pop_thrd_rings(struct deliver_thrd *thrdp)
+{
+    struct deliver_ring *ringp = NULL;
+    struct frm_copy *cp = NULL;
+
+    list_for_each_entry(ringp, &thrdp->ring_list, entry) {
+        if ((cp = pop_deliver_ring(ringp)) != NULL) {
+            list_move_tail(&ringp->entry, &thrdp->ring_list);
+            return cp;
+        }
+    }
+    return NULL;
+}
+
+static void *deliver_thrd(void *arg)
+{
+    struct deliver_thrd *thrdp = arg;
+    struct frm_copy *cp[MAX_BATCH_NUM];
+    struct frm_batch batch;
+    unsigned int num = 0;
+    unsigned int i = 0;
+
+    batch.num = 0;
+    while (1) {
+        if (sem_wait(&thrdp->sem) < 0) {
+            continue;           /* EINTR */
+        }
+
+        /* Take what's ready at once, one post per frame. */
+        pthread_mutex_lock(&thrdp->mutex);
+        if (!thrdp->running) {
+            pthread_mutex_unlock(&thrdp->mutex);
+            break;
+        }
+        num = 0;
+        do {
+            if ((cp[num] = pop_thrd_rings(thrdp)) != NULL) {
+                num++;          /* or the ring was detached */
+            }
+        } while (num < MAX_BATCH_NUM && !sem_trywait(&thrdp->sem));
+        thrdp->busy = 1;
+        pthread_mutex_unlock(&thrdp->mutex);
+
+        for (i = 0; i < num; i++) {
+            pass_frm_copy(&batch, cp[i]);
+        }
+        flush_frm_batch(&batch);
+
+        pthread_mutex_lock(&thrdp->mutex);
+        thrdp->busy = 0;
+        pthread_cond_broadcast(&thrdp->cond);
+        pthread_mutex_unlock(&thrdp->mutex);
+    }
+    return NULL;
+}
+
+void init_deliver_pool(struct deliver_pool *poolp)
+{
+    memset(poolp, 0, sizeof(*poolp));
+    pthread_mutex_init(&poolp->mutex, NULL);
+    poolp->thrd_num = DFL_DELIVER_THRD_NUM;
+    return;
+}
+
+void deinit_deliver_pool(struct deliver_pool *poolp)
+{
+    struct deliver_thrd *thrdp = NULL;
+    unsigned int i = 0;
+
+    for (i = 0; i < poolp->started; i++) {
+        thrdp = &poolp->thrd[i];
+        pthread_mutex_lock(&thrdp->mutex);
+        thrdp->running = 0;
+        pthread_mutex_unlock(&thrdp->mutex);
+        sem_post(&thrdp->sem);
+        pthread_join(thrdp->tid, NULL);
+
+        sem_destroy(&thrdp->sem);
+        pthread_cond_destroy(&thrdp->cond);
+        pthread_mutex_destroy(&thrdp->mutex);
+    }
+    poolp->started = 0;
+    pthread_mutex_destroy(&poolp->mutex);
+    return;
+}
+
+/* Must be called with poolp->mutex held. */
+static int start_deliver_thrds(struct deliver_pool *poolp)
+{
+    struct deliver_thrd *thrdp = NULL;
+    int ret = 0;
+
+    while (poolp->started < poolp->thrd_num) {
+        thrdp = &poolp->thrd[poolp->started];
+        INIT_LIST_HEAD(&thrdp->ring_list);
+        sem_init(&thrdp->sem, 0, 0);
+        pthread_mutex_init(&thrdp->mutex, NULL);
+        pthread_cond_init(&thrdp->cond, NULL);
+        thrdp->busy = 0;
+        thrdp->running = 1;
+        if ((ret = pthread_create(&thrdp->tid, NULL, deliver_thrd, thrdp)) != 0) {
+            printd(ERR "Create thread deliver_thrd error: %s\n", strerror(ret));
+            sem_destroy(&thrdp->sem);
+            pthread_cond_destroy(&thrdp->cond);
+            pthread_mutex_destroy(&thrdp->mutex);
+            break;
+        }
+        poolp->started++;
+    }
+    return poolp->started ? 0 : -1;
+}
+
+/**
+ * Bind a ring of the session to one deliver thread,
+ * or to an eventfd in pull mode.
+ */
+int attach_deliver_ring(struct rtsp_sess *sessp)
+{
+    struct deliver_pool *poolp = &rtsp_cli.deliver_pool;
+    struct deliver_ring *ringp = NULL;
+    struct deliver_thrd *thrdp = NULL;
+
+    ringp = mallocz(sizeof(*ringp));
+    if (!ringp) {
+        printd(ERR "Allocate memory for deliver ring failed!\n");
+        return -1;
+    }
+    ringp->sessp = sessp;
+    ringp->evfd = -1;
+
+    if (sessp->chn_info.flags & CHN_FLAG_PULL) {
+        ringp->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (ringp->evfd < 0) {
+            printd(ERR "eventfd() error: %s\n", strerror(errno));
+            freez(ringp);
+            return -1;
+        }
+        ringp->notify_fd = ringp->evfd;
+        sessp->deliver_ring = ringp;
+        return 0;
+    }
+
+    pthread_mutex_lock(&poolp->mutex);
+    if (start_deliver_thrds(poolp) < 0) {
+        pthread_mutex_unlock(&poolp->mutex);
+        freez(ringp);
+        return -1;
+    }
+    thrdp = &poolp->thrd[poolp->next++ % poolp->started];
+    pthread_mutex_unlock(&poolp->mutex);
+
+    ringp->thrd = thrdp;
+    pthread_mutex_lock(&thrdp->mutex);
+    list_add_tail(&ringp->entry, &thrdp->ring_list);
+    pthread_mutex_unlock(&thrdp->mutex);
+
+    sessp->deliver_ring = ringp;
+    return 0;
+}
+
+/**
+ * Unbind the ring, wait for the frame being passed on,
+ * and free frames left.
+ */
+void detach_deliver_ring(struct rtsp_sess *sessp)
+{
+    struct deliver_ring *ringp = sessp->deliver_ring;
+    struct deliver_thrd *thrdp = NULL;
+    unsigned int i = 0;
+
+    if (!ringp) {
+        return;
+    }
+
+    if ((thrdp = ringp->thrd) != NULL) {
+        pthread_mutex_lock(&thrdp->mutex);
+        list_del(&ringp->entry);
+        while (thrdp->busy) {
+            pthread_cond_wait(&thrdp->cond, &thrdp->mutex);
+        }
+        pthread_mutex_unlock(&thrdp->mutex);
+    }
+    if (ringp->evfd >= 0) {
+        close(ringp->evfd);
+    }
+
+    for (i = ringp->tail; i != ringp->head; i++) {
+        freez(ringp->slot[i & (DELIVER_RING_SZ - 1)]);
+    }
+    freez(ringp);
+    sessp->deliver_ring = NULL;
+    return;
+}
+
+/**
+ * Count the frame dropped by its type, a frame in parts is
+ * counted once. With CHN_FLAG_PACING the session thread also
+ * counts the frames it can't pass to playout thread.
+ */
+void count_drop_stat(struct deliver_ring *ringp, const struct frm_info *frmp)
+{
+    struct drop_stat *statp = &ringp->drop_stat;
+    unsigned int *cntp = NULL;
+
+    if (frmp->frm_type == FRM_TYPE_AF) {
+        cntp = &statp->audio;
+    } else if (!(frmp->flags & FRM_FLAG_START)) {
+        return;
+    } else if (frmp->frm_type == FRM_TYPE_IF) {
+        cntp = &statp->key;
+    } else if (frmp->flags & FRM_FLAG_NONREF) {
+        cntp = &statp->nonref;
+    } else {
+        cntp = &statp->ref;
+    }
+    __atomic_add_fetch(cntp, 1, __ATOMIC_RELAXED);
+    return;
+}
+
+/**
+ * Count the frame dropped, the rest of GOP is dropped
+ * if it's used for reference.
+ */
+static void count_drop(struct deliver_ring *ringp, const struct frm_info *frmp)
+{
+    count_drop_stat(ringp, frmp);
+    if (frmp->frm_type == FRM_TYPE_AF) {
+        return;
+    }
+
+    if (!(frmp->flags & FRM_FLAG_END)) {
+        ringp->frm_shed = 1;
+    }
+    if (!(frmp->flags & FRM_FLAG_NONREF)) {
+        ringp->gop_shed = 1;
+    }
+    return;
+}
+
+/**
+ * Decide whether to drop the frame as the ring fills up, so it degrades
+ * in a decodable way: non-reference frames go first, then the rest of
+ * GOP from a reference frame on, key frames only when the ring is full,
+ * which is also the only case audio is dropped.
+ * Parts of a frame(CHN_FLAG_SLICE) follow the decision on its first part.
+ */
+static int shed_frm(struct deliver_ring *ringp, const struct frm_info *frmp)
+{
+    unsigned int used = ringp->head - __atomic_load_n(&ringp->tail, __ATOMIC_ACQUIRE);
+    unsigned int mark = DELIVER_RING_SZ;
+
+    if (frmp->frm_type != FRM_TYPE_AF) {
+        if (!(frmp->flags & FRM_FLAG_START)) {
+            if (ringp->frm_shed) {
+                ringp->frm_shed = !(frmp->flags & FRM_FLAG_END);
+                return 1;
+            }
+        } else if (frmp->frm_type == FRM_TYPE_IF) {
+            ringp->gop_shed = 0;
+            ringp->frm_shed = 0;
+        } else if (ringp->gop_shed) {
+            ringp->frm_shed = !(frmp->flags & FRM_FLAG_END);
+            count_drop_stat(ringp, frmp);
+            return 1;
+        } else if (frmp->flags & FRM_FLAG_NONREF) {
+            mark = NONREF_SHED_MARK;
+        } else {
+            mark = REF_SHED_MARK;
+        }
+    }
+
+    if (used >= mark) {
+        if (used >= DELIVER_RING_SZ) {
+            printd(WARNING "Deliver ring is full, drop frame!\n");
+        }
+        count_drop(ringp, frmp);
+        return 1;
+    }
+    return 0;
+}
+
+static void enqueue_frm(struct deliver_ring *ringp, struct frm_copy *cp)
+{
+    unsigned long long one = 1;
+    unsigned int head = ringp->head;
+
+    ringp->slot[head & (DELIVER_RING_SZ - 1)] = cp;
+    __atomic_store_n(&ringp->head, head + 1, __ATOMIC_RELEASE);
+    if (ringp->thrd) {
+        sem_post(&ringp->thrd->sem);
+    } else if (write(__atomic_load_n(&ringp->notify_fd, __ATOMIC_RELAXED),
+                     &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        printd(WARNING "Notify eventfd error: %s\n", strerror(errno));
+    }
+    return;
+}
+
+/**
+ * Put the frame copy into the ring, by its only producer, and wake up
+ * the consumer. The producer is never blocked by user, see shed_frm().
+ */
+int put_deliver_ring(struct deliver_ring *ringp, struct frm_copy *cp)
+{
+    if (shed_frm(ringp, &cp->frm_info)) {
+        freez(cp);
+        return -1;
+    }
+    enqueue_frm(ringp, cp);
+    return 0;
+}
+
+/**
+ * Copy the frame into the ring of the session.
+ */
+int push_deliver_ring(struct rtsp_sess *sessp, const struct frm_info *frmp)
+{
+    struct deliver_ring *ringp = sessp->deliver_ring;
+    struct frm_copy *cp = NULL;
+
+    if (shed_frm(ringp, frmp)) {
+        return -1;
+    }
+
+    cp = copy_frm(sessp, frmp);
+    if (!cp) {
+        count_drop(ringp, frmp);
+        return -1;
+    }
+    enqueue_frm(ringp, cp);
+    return 0;
+}
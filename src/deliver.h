@@ -0,0 +1,94 @@
+/*********************************************************************
+ * File Name    : deliver.h
+ * Description  : Pass frames on to user from a pool of threads,
+ *                out of the session thread.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-03-01
+ ********************************************************************/
+
+#ifndef __DELIVER_H__
+#define __DELIVER_H__
+
+
+#include <pthread.h>
+#include <semaphore.h>
+#include "list.h"
+#include "librtspcli.h"
+
+#define DELIVER_RING_SZ         64  /* frames queued per channel, power of 2 */
+#define NONREF_SHED_MARK        (DELIVER_RING_SZ / 2)       /* drop non-reference frames */
+#define REF_SHED_MARK           (DELIVER_RING_SZ * 3 / 4)   /* drop the rest of GOP */
+#define DFL_DELIVER_THRD_NUM    2
+#define MAX_DELIVER_THRD_NUM    32
+#define MAX_BATCH_NUM           32  /* frames passed on by one store_frms_t call */
+
+/* copy of a frame, passed on out of the session thread */
+struct frm_copy {
+    struct list_head entry;         /* used by playout */
+    struct rtsp_sess *sessp;
+    unsigned long long due;         /* used by playout */
+    struct frm_info frm_info;
+    char data[0];                   /* frame header room, frame, NALU index */
+};
+
+/*
+ * Ring of one channel, single producer(session or playout thread),
+ * single consumer(the deliver thread it's bound to, or user calling
+ * get_frm() in pull mode), so frames of a channel keep their order
+ * without locks.
+ */
+struct deliver_ring {
+    struct list_head entry;         /* entry of ring list of deliver thread */
+    struct rtsp_sess *sessp;
+    struct deliver_thrd *thrd;      /* NULL in pull mode */
+    int evfd;                       /* pull mode, eventfd of the channel */
+    int notify_fd;                  /* pull mode, eventfd signalled, evfd or set by user */
+    unsigned int head;              /* written by producer only */
+    unsigned int tail;              /* written by consumer only */
+    struct drop_stat drop_stat;     /* frames dropped as user falls behind */
+    int gop_shed;                   /* a reference frame was dropped, wait for key frame */
+    int frm_shed;                   /* the frame in parts(CHN_FLAG_SLICE) is dropped */
+    struct frm_copy *slot[DELIVER_RING_SZ];
+};
+
+struct deliver_thrd {
+    pthread_t tid;
+    sem_t sem;                      /* posted once per frame pushed */
+    pthread_mutex_t mutex;          /* protects ring_list & busy */
+    pthread_cond_t cond;
+    struct list_head ring_list;
+    int busy;                       /* frames taken from rings are being passed on */
+    int running;
+};
+
+/* frames to be passed on by one store_frms_t call */
+struct frm_batch {
+    unsigned int num;
+    struct frm_copy *frm[MAX_BATCH_NUM];
+    struct chn_frm chn_frm[MAX_BATCH_NUM];
+};
+
+/* Threads are started when the first ring is attached. */
+struct deliver_pool {
+    pthread_mutex_t mutex;
+    unsigned int thrd_num;
+    unsigned int started;           /* threads started */
+    unsigned int next;              /* rings are bound to threads round robin */
+    struct deliver_thrd thrd[MAX_DELIVER_THRD_NUM];
+};
+
+struct rtsp_sess;
+struct frm_copy *copy_frm(struct rtsp_sess *sessp, const struct frm_info *frmp);
+void init_deliver_pool(struct deliver_pool *poolp);
+void deinit_deliver_pool(struct deliver_pool *poolp);
+int attach_deliver_ring(struct rtsp_sess *sessp);
+void detach_deliver_ring(struct rtsp_sess *sessp);
+int push_deliver_ring(struct rtsp_sess *sessp, const struct frm_info *frmp);
+int put_deliver_ring(struct deliver_ring *ringp, struct frm_copy *cp);
+void count_drop_stat(struct deliver_ring *ringp, const struct frm_info *frmp);
+struct frm_copy *pop_deliver_ring(struct deliver_ring *ringp);
+void flush_frm_batch(struct frm_batch *bp);
+void add_frm_batch(struct frm_batch *bp, struct frm_copy *cp);
+
+
+#endif /* __DELIVER_H__ */
@@ -0,0 +1,232 @@
+/*********************************************************************
+ * File Name    : g711.c
+ * Description  : Decode G.711 A-law/u-law to linear PCM16.
+ *                16 samples are decoded at a time with SSSE3 or NEON,
+ *                the rest are decoded one by one.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-02-18
+ ********************************************************************/
+
+#include <string.h>
+#include "g711.h"
+
+#if defined (__x86_64__) || defined (__i386__)
+#include <tmmintrin.h>
+#define G711_SSSE3
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#define G711_NEON
+#endif
+
+
+/*
+ * A-law: sign, 3 bits exponent, 4 bits mantissa, even bits inverted.
+ * mag = ((mant << 4) + 8) << (exp - 1), plus 0x100 << (exp - 1) if exp > 0.
+ */
+static short alaw_to_linear(unsigned char a)
+{
+    int exp = 0;
+    int mag = 0;
+
+    a ^= 0x55;
+    exp = (a >> 4) & 0x07;
+    mag = ((a & 0x0F) << 4) + 8;
+    if (exp) {
+        mag = (mag + 0x100) << (exp - 1);
+    }
+    return (a & 0x80) ? mag : -mag;
+}
+
+/*
+ * u-law: all bits inverted, sign, 3 bits exponent, 4 bits mantissa.
+ * mag = (((mant << 3) + 0x84) << exp) - 0x84.
+ */
+static short ulaw_to_linear(unsigned char u)
+{
+    int mag = 0;
+
+    u = ~u;
+    mag = ((((u & 0x0F) << 3) + 0x84) << ((u >> 4) & 0x07)) - 0x84;
+    return (u & 0x80) ? -mag : mag;
+}
+
+#ifdef G711_SSSE3
+/*
+ * There's no variable shift for 16 bits lanes in SSE,
+ * so the shift is done by multiplying 1 << exp got with pshufb.
+ */
+__attribute__((target("ssse3")))
+static unsigned int alaw_to_pcm16_ssse3(const unsigned char *in, char *out, unsigned int n)
+{
+    const __m128i pow_tbl = _mm_setr_epi8(1, 1, 2, 4, 8, 16, 32, 64,
+                                          0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i seg_tbl = _mm_setr_epi8(0, 1, 2, 4, 8, 16, 32, 64, /* 0x100 << (exp - 1) >> 8 */
+                                          0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v, exp, pow, seg, mant, sign, t;
+    unsigned int i = 0;
+    int h = 0;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + i)), _mm_set1_epi8(0x55));
+        exp = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x07));
+        pow = _mm_shuffle_epi8(pow_tbl, exp);
+        seg = _mm_shuffle_epi8(seg_tbl, exp);
+        mant = _mm_and_si128(v, _mm_set1_epi8(0x0F));
+
+        for (h = 0; h < 2; h++) {
+            if (!h) {
+                t = _mm_unpacklo_epi8(mant, zero);
+                t = _mm_mullo_epi16(_mm_add_epi16(_mm_slli_epi16(t, 4), _mm_set1_epi16(8)),
+                                    _mm_unpacklo_epi8(pow, zero));
+                t = _mm_add_epi16(t, _mm_unpacklo_epi8(zero, seg));
+                sign = _mm_unpacklo_epi8(v, zero);
+            } else {
+                t = _mm_unpackhi_epi8(mant, zero);
+                t = _mm_mullo_epi16(_mm_add_epi16(_mm_slli_epi16(t, 4), _mm_set1_epi16(8)),
+                                    _mm_unpackhi_epi8(pow, zero));
+                t = _mm_add_epi16(t, _mm_unpackhi_epi8(zero, seg));
+                sign = _mm_unpackhi_epi8(v, zero);
+            }
+            /* Sign bit clear means negative: (t ^ -1) - -1 == -t. */
+            sign = _mm_cmpeq_epi16(_mm_and_si128(sign, _mm_set1_epi16(0x80)), zero);
+            t = _mm_sub_epi16(_mm_xor_si128(t, sign), sign);
+            _mm_storeu_si128((__m128i *)(out + 2 * (i + 8 * h)), t);
+        }
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static unsigned int ulaw_to_pcm16_ssse3(const unsigned char *in, char *out, unsigned int n)
+{
+    const __m128i pow_tbl = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                          0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v, exp, pow, mant, sign, t;
+    unsigned int i = 0;
+    int h = 0;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + i)), _mm_set1_epi8(-1));
+        exp = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x07));
+        pow = _mm_shuffle_epi8(pow_tbl, exp);
+        mant = _mm_and_si128(v, _mm_set1_epi8(0x0F));
+
+        for (h = 0; h < 2; h++) {
+            if (!h) {
+                t = _mm_unpacklo_epi8(mant, zero);
+                t = _mm_mullo_epi16(_mm_add_epi16(_mm_slli_epi16(t, 3), _mm_set1_epi16(0x84)),
+                                    _mm_unpacklo_epi8(pow, zero));
+                sign = _mm_unpacklo_epi8(v, zero);
+            } else {
+                t = _mm_unpackhi_epi8(mant, zero);
+                t = _mm_mullo_epi16(_mm_add_epi16(_mm_slli_epi16(t, 3), _mm_set1_epi16(0x84)),
+                                    _mm_unpackhi_epi8(pow, zero));
+                sign = _mm_unpackhi_epi8(v, zero);
+            }
+            t = _mm_sub_epi16(t, _mm_set1_epi16(0x84));
+            /* Sign bit set means negative. */
+            sign = _mm_cmpeq_epi16(_mm_and_si128(sign, _mm_set1_epi16(0x80)),
+                                   _mm_set1_epi16(0x80));
+            t = _mm_sub_epi16(_mm_xor_si128(t, sign), sign);
+            _mm_storeu_si128((__m128i *)(out + 2 * (i + 8 * h)), t);
+        }
+    }
+    return i;
+}
+#endif /* G711_SSSE3 */
+
+#ifdef G711_NEON
+/*
+ * NEON has variable shift for 16 bits lanes, no table needed.
+ */
+static unsigned int alaw_to_pcm16_neon(const unsigned char *in, char *out, unsigned int n)
+{
+    uint8x16_t v;
+    uint16x8_t x, exp, t;
+    int16x8_t r;
+    unsigned int i = 0;
+    int h = 0;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        v = veorq_u8(vld1q_u8(in + i), vdupq_n_u8(0x55));
+        for (h = 0; h < 2; h++) {
+            x = vmovl_u8(h ? vget_high_u8(v) : vget_low_u8(v));
+            exp = vandq_u16(vshrq_n_u16(x, 4), vdupq_n_u16(0x07));
+            t = vaddq_u16(vshlq_n_u16(vandq_u16(x, vdupq_n_u16(0x0F)), 4), vdupq_n_u16(8));
+            t = vaddq_u16(t, vshlq_n_u16(vminq_u16(exp, vdupq_n_u16(1)), 8));
+            t = vshlq_u16(t, vreinterpretq_s16_u16(vqsubq_u16(exp, vdupq_n_u16(1))));
+            r = vreinterpretq_s16_u16(t);
+            r = vbslq_s16(vtstq_u16(x, vdupq_n_u16(0x80)), r, vnegq_s16(r));
+            vst1q_u8((uint8_t *)(out + 2 * (i + 8 * h)), vreinterpretq_u8_s16(r));
+        }
+    }
+    return i;
+}
+
+static unsigned int ulaw_to_pcm16_neon(const unsigned char *in, char *out, unsigned int n)
+{
+    uint8x16_t v;
+    uint16x8_t x, exp, t;
+    int16x8_t r;
+    unsigned int i = 0;
+    int h = 0;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        v = vmvnq_u8(vld1q_u8(in + i));
+        for (h = 0; h < 2; h++) {
+            x = vmovl_u8(h ? vget_high_u8(v) : vget_low_u8(v));
+            exp = vandq_u16(vshrq_n_u16(x, 4), vdupq_n_u16(0x07));
+            t = vaddq_u16(vshlq_n_u16(vandq_u16(x, vdupq_n_u16(0x0F)), 3), vdupq_n_u16(0x84));
+            t = vsubq_u16(vshlq_u16(t, vreinterpretq_s16_u16(exp)), vdupq_n_u16(0x84));
+            r = vreinterpretq_s16_u16(t);
+            r = vbslq_s16(vtstq_u16(x, vdupq_n_u16(0x80)), vnegq_s16(r), r);
+            vst1q_u8((uint8_t *)(out + 2 * (i + 8 * h)), vreinterpretq_u8_s16(r));
+        }
+    }
+    return i;
+}
+#endif /* G711_NEON */
+
+void alaw_to_pcm16(const unsigned char *in, void *out, unsigned int n)
+{
+    char *dst = out;
+    unsigned int i = 0;
+    short s = 0;
+
+#if defined (G711_SSSE3)
+    if (__builtin_cpu_supports("ssse3")) {
+        i = alaw_to_pcm16_ssse3(in, dst, n);
+    }
+#elif defined (G711_NEON)
+    i = alaw_to_pcm16_neon(in, dst, n);
+#endif
+
+    for (; i < n; i++) {
+        s = alaw_to_linear(in[i]);
+        memcpy(dst + 2 * i, &s, sizeof(s));
+    }
+    return;
+}
+
+void ulaw_to_pcm16(const unsigned char *in, void *out, unsigned int n)
+{
+    char *dst = out;
+    unsigned int i = 0;
+    short s = 0;
+
+#if defined (G711_SSSE3)
+    if (__builtin_cpu_supports("ssse3")) {
+        i = ulaw_to_pcm16_ssse3(in, dst, n);
+    }
+#elif defined (G711_NEON)
+    i = ulaw_to_pcm16_neon(in, dst, n);
+#endif
+
+    for (; i < n; i++) {
+        s = ulaw_to_linear(in[i]);
+        memcpy(dst + 2 * i, &s, sizeof(s));
+    }
+    return;
+}
@@ -0,0 +1,20 @@
+/*********************************************************************
+ * File Name    : g711.h
+ * Description  : Decode G.711 A-law/u-law to linear PCM16.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-02-18
+ ********************************************************************/
+
+#ifndef __G711_H__
+#define __G711_H__
+
+
+/*
+ * Decode n samples from in to out(host byte order).
+ * out needn't be aligned.
+ */
+void alaw_to_pcm16(const unsigned char *in, void *out, unsigned int n);
+void ulaw_to_pcm16(const unsigned char *in, void *out, unsigned int n);
+
+
+#endif /* __G711_H__ */
@@ -0,0 +1,122 @@
+/*********************************************************************
+ * File Name    : gop_cache.c
+ * Description  : Keep frames from the last key frame on, to start
+ *                channels joining a running session at once.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-03-08
+ ********************************************************************/
+
+#include <stdio.h>
+#include "log.h"
+#include "util.h"
+#include "rtsp_cli.h"
+#include "gop_cache.h"
+
+
+void init_gop_cache(struct gop_cache *gcp, unsigned int budget)
+{
+    INIT_LIST_HEAD(&gcp->frm_list);
+    gcp->sz = 0;
+    gcp->budget = budget;
+    gcp->valid = 0;
+    return;
+}
+
+static void clear_gop_cache(struct gop_cache *gcp)
+{
+    struct frm_copy *cp = NULL;
+    struct frm_copy *tmp = NULL;
+
+    list_for_each_entry_safe(cp, tmp, &gcp->frm_list, entry) {
+        list_del(&cp->entry);
+        freez(cp);
+    }
+    gcp->sz = 0;
+    gcp->valid = 0;
+    return;
+}
+
+void deinit_gop_cache(struct gop_cache *gcp)
+{
+    clear_gop_cache(gcp);
+    return;
+}
+
+/**
+ * Cache the frame being passed on, a key frame starts the cache over.
+ * If the GOP outgrows the budget, nothing is cached till the next
+ * key frame, a part of GOP can't be decoded anyway.
+ * Must be called with sessp->sub_mutex held.
+ */
+void cache_gop_frm(struct rtsp_sess *sessp, const struct frm_info *frmp)
+{
+    struct gop_cache *gcp = &sessp->gop_cache;
+    struct frm_copy *cp = NULL;
+    unsigned int sz = 0;
+
+    if (!gcp->budget) {
+        return;
+    }
+
+    if (frmp->frm_type == FRM_TYPE_IF && (frmp->flags & FRM_FLAG_START)) {
+        clear_gop_cache(gcp);
+        gcp->valid = 1;
+    }
+    if (!gcp->valid) {
+        return;
+    }
+
+    sz = sizeof(*cp) + sessp->chn_info.frm_hdr_sz + frmp->frm_sz +
+        frmp->nalu_num * sizeof(struct nalu_info);
+    if (gcp->sz + sz > gcp->budget || !(cp = copy_frm(sessp, frmp))) {
+        clear_gop_cache(gcp);
+        return;
+    }
+    list_add_tail(&cp->entry, &gcp->frm_list);
+    gcp->sz += sz;
+    return;
+}
+
+/**
+ * Pass the cached frames on to the channel joining the session,
+ * before any live frame. They go to the callback in the thread
+ * joining, live frames of the session wait on sub_mutex meanwhile.
+ * Must be called with sub_mutex of its session held,
+ * but not rtsp_cli.list_mutex, so other sessions aren't blocked.
+ */
+void prime_rtsp_sub(struct rtsp_sub *subp)
+{
+    struct gop_cache *gcp = &subp->sessp->gop_cache;
+    struct frm_info frm_info[MAX_BATCH_NUM];
+    struct chn_frm chn_frm[MAX_BATCH_NUM];
+    struct frm_copy *cp = NULL;
+    int batch = (subp->chn_info.flags & CHN_FLAG_BATCH) && rtsp_cli.store_frms;
+    unsigned int num = 0;
+
+    if (!gcp->valid) {
+        return;
+    }
+
+    list_for_each_entry(cp, &gcp->frm_list, entry) {
+        frm_info[num] = cp->frm_info;
+        frm_info[num].flags |= FRM_FLAG_CACHED;
+        if (subp->recp) {
+            put_rec_frm(subp->recp, &frm_info[num]);
+            continue;
+        }
+        if (!batch) {
+            rtsp_cli.store_frm(&subp->chn_info, &frm_info[num]);
+            continue;
+        }
+        chn_frm[num].chnp = &subp->chn_info;
+        chn_frm[num].frmp = &frm_info[num];
+        if (++num == MAX_BATCH_NUM) {
+            rtsp_cli.store_frms(chn_frm, num);
+            num = 0;
+        }
+    }
+    if (num) {
+        rtsp_cli.store_frms(chn_frm, num);
+    }
+    return;
+}
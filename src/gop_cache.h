@@ -0,0 +1,35 @@
+/*********************************************************************
+ * File Name    : gop_cache.h
+ * Description  : Keep frames from the last key frame on, to start
+ *                channels joining a running session at once.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-03-08
+ ********************************************************************/
+
+#ifndef __GOP_CACHE_H__
+#define __GOP_CACHE_H__
+
+
+#include "list.h"
+#include "librtspcli.h"
+
+/*
+ * Frames(video & audio) from the last key frame on, in the order
+ * they're passed on. Protected by sub_mutex of the session.
+ */
+struct gop_cache {
+    struct list_head frm_list;      /* list of struct frm_copy */
+    unsigned int sz;                /* bytes cached */
+    unsigned int budget;            /* 0 for no cache */
+    int valid;                      /* it starts with a key frame and fits the budget */
+};
+
+struct rtsp_sess;
+struct rtsp_sub;
+void init_gop_cache(struct gop_cache *gcp, unsigned int budget);
+void deinit_gop_cache(struct gop_cache *gcp);
+void cache_gop_frm(struct rtsp_sess *sessp, const struct frm_info *frmp);
+void prime_rtsp_sub(struct rtsp_sub *subp);
+
+
+#endif /* __GOP_CACHE_H__ */
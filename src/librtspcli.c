@@ -7,11 +7,13 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include "librtspcli.h"
 #include "rtsp_method.h"
 #include "rtsp_cli.h"
+#include "sess_cache.h"
 #include "log.h"
 
 
@@ -19,6 +21,12 @@
 struct rtsp_cli rtsp_cli;
 
 
+/* User ID is the subscriber, channels of one stream share the session. */
+static inline struct rtsp_sess *usr_sess(unsigned long usr_id)
+{
+    return usr_id ? ((struct rtsp_sub *)usr_id)->sessp : NULL;
+}
+
 unsigned long open_chn(char *uri, struct chn_info *chnp, int intlvd)
 {
     unsigned long usr_id = 0;
@@ -44,9 +52,29 @@ unsigned long open_chn(char *uri, struct chn_info *chnp, int intlvd)
     srv_addr.sin_port = htons(port);
     srv_addr.sin_addr.s_addr = inet_addr(ip_addr);
 
-    sessp = create_rtsp_sess(uri, &srv_addr, chnp, intlvd);
-    usr_id = (unsigned long)sessp;
+    /*
+     * Share the session playing the same stream, or create it,
+     * in one hold of list_mutex. The session joined is pinned by
+     * its reference, sub_mutex is taken after list_mutex is released.
+     */
+    pthread_mutex_lock(&rtsp_cli.list_mutex);
+    sessp = find_rtsp_sess(uri, chnp, intlvd);
+    if (sessp) {
+        sessp->ref++;
+    } else {
+        sessp = create_rtsp_sess(uri, &srv_addr, chnp, intlvd);
+        if (sessp) {
+            usr_id = (unsigned long)list_first_entry(&sessp->sub_list, struct rtsp_sub, entry);
+        }
+        pthread_mutex_unlock(&rtsp_cli.list_mutex);
+        return usr_id;
+    }
+    pthread_mutex_unlock(&rtsp_cli.list_mutex);
 
+    usr_id = (unsigned long)add_rtsp_sub(sessp, chnp, NULL);
+    if (!usr_id) {
+        put_rtsp_sess(sessp);
+    }
     return usr_id;
 }
 
@@ -58,10 +86,11 @@ void close_chn(unsigned long usr_id)
         printd(ERR "Illegal user ID!\n");
         return;
     }
-    sessp = (struct rtsp_sess *)usr_id;
+    sessp = usr_sess(usr_id);
 
-    sessp->todo = RTSP_METHOD_TEARDOWN;
-    send_method_teardown(sessp);
+    /* Tear down when the last channel leaves. */
+    del_rtsp_sub((struct rtsp_sub *)usr_id);
+    put_rtsp_sess(sessp);
     return;
 }
 
@@ -74,6 +103,11 @@ int init_rtsp_cli(store_frm_t store_frm)
     rtsp_cli.store_frm = store_frm;
     INIT_LIST_HEAD(&rtsp_cli.rtsp_sess_list);
     pthread_mutex_init(&rtsp_cli.list_mutex, NULL);
+    INIT_LIST_HEAD(&rtsp_cli.sess_cache_list);
+    pthread_mutex_init(&rtsp_cli.cache_mutex, NULL);
+    init_playout(&rtsp_cli.playout);
+    init_deliver_pool(&rtsp_cli.deliver_pool);
+    init_rec_writer(&rtsp_cli.rec_writer);
 
     return 0;
 }
@@ -88,6 +122,13 @@ void deinit_rtsp_cli(void)
     }
 
     pthread_mutex_destroy(&rtsp_cli.list_mutex);
+
+    deinit_playout(&rtsp_cli.playout);
+    deinit_deliver_pool(&rtsp_cli.deliver_pool);
+    deinit_rec_writer(&rtsp_cli.rec_writer);
+
+    clear_sess_cache();
+    pthread_mutex_destroy(&rtsp_cli.cache_mutex);
     return;
 }
 
@@ -99,7 +140,232 @@ int chn_playing(unsigned long usr_id)
         printd(ERR "Illegal user ID!\n");
         return 0;
     }
-    sessp = (struct rtsp_sess *)usr_id;
+    sessp = usr_sess(usr_id);
 
     return sessp->rtsp_state == RTSP_STATE_PLAYING;
 }
+
+int set_chn_decim(unsigned long usr_id, enum decim_mode mode, unsigned gop)
+{
+    struct rtsp_sub *subp = (struct rtsp_sub *)usr_id;
+    struct rtsp_sess *sessp = NULL;
+
+    if (!usr_id || mode > DECIM_GOP) {
+        printd(ERR "Illegal user ID or decimation mode!\n");
+        return -1;
+    }
+    sessp = usr_sess(usr_id);
+
+    /*
+     * Other channels of the session opened without it, and the session
+     * is matched by its chn_info, so it's changed under list_mutex.
+     * The session thread reads mode first, then gop.
+     */
+    pthread_mutex_lock(&rtsp_cli.list_mutex);
+    if (sessp->ref > 1) {
+        pthread_mutex_unlock(&rtsp_cli.list_mutex);
+        printd(ERR "Decimation of shared session can't be changed!\n");
+        return -1;
+    }
+    __atomic_store_n(&sessp->chn_info.decim_gop, gop, __ATOMIC_RELAXED);
+    __atomic_store_n(&sessp->chn_info.decim_mode, mode, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&rtsp_cli.list_mutex);
+
+    pthread_mutex_lock(&sessp->sub_mutex);
+    subp->chn_info.decim_gop = gop;
+    subp->chn_info.decim_mode = mode;
+    pthread_mutex_unlock(&sessp->sub_mutex);
+    return 0;
+}
+
+int get_codec_cfg(unsigned long usr_id, char *buf, unsigned int sz)
+{
+    struct rtsp_sess *sessp = NULL;
+
+    if (!usr_id || !buf) {
+        printd(ERR "Illegal user ID!\n");
+        return -1;
+    }
+    sessp = usr_sess(usr_id);
+
+    if (sessp->codec_cfg_sz <= 0 || sessp->codec_cfg_sz > sz) {
+        return -1;
+    }
+    memcpy(buf, sessp->codec_cfg, sessp->codec_cfg_sz);
+    return sessp->codec_cfg_sz;
+}
+
+static struct deliver_ring *get_pull_ring(unsigned long usr_id)
+{
+    struct rtsp_sess *sessp = NULL;
+
+    if (!usr_id) {
+        printd(ERR "Illegal user ID!\n");
+        return NULL;
+    }
+    sessp = usr_sess(usr_id);
+
+    if (!sessp->deliver_ring || sessp->deliver_ring->thrd) {
+        printd(ERR "Channel not in pull mode!\n");
+        return NULL;
+    }
+    return sessp->deliver_ring;
+}
+
+int get_frm_fd(unsigned long usr_id)
+{
+    struct deliver_ring *ringp = get_pull_ring(usr_id);
+
+    return ringp ? ringp->evfd : -1;
+}
+
+int set_frm_fd(unsigned long usr_id, int fd)
+{
+    struct deliver_ring *ringp = get_pull_ring(usr_id);
+
+    if (!ringp) {
+        return -1;
+    }
+    __atomic_store_n(&ringp->notify_fd, fd < 0 ? ringp->evfd : fd, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int get_frm(unsigned long usr_id, struct frm_info *frms, unsigned int num)
+{
+    struct deliver_ring *ringp = get_pull_ring(usr_id);
+    struct frm_copy *cp = NULL;
+    unsigned int i = 0;
+
+    if (!ringp || !frms) {
+        return -1;
+    }
+
+    for (i = 0; i < num; i++) {
+        if (!(cp = pop_deliver_ring(ringp))) {
+            break;
+        }
+        frms[i] = cp->frm_info;
+    }
+    return i;
+}
+
+void release_frm(struct frm_info *frms, unsigned int num)
+{
+    unsigned int i = 0;
+
+    for (i = 0; i < num; i++) {
+        free(frms[i].frm_buf - offsetof(struct frm_copy, data));
+    }
+    return;
+}
+
+int get_drop_stat(unsigned long usr_id, struct drop_stat *statp)
+{
+    struct rtsp_sess *sessp = NULL;
+
+    if (!usr_id || !statp) {
+        printd(ERR "Illegal user ID or statistics buffer!\n");
+        return -1;
+    }
+    sessp = usr_sess(usr_id);
+
+    if (!sessp->deliver_ring) {
+        printd(ERR "Channel without delivery ring!\n");
+        return -1;
+    }
+    *statp = sessp->deliver_ring->drop_stat;
+    return 0;
+}
+
+int get_shm_fd(unsigned long usr_id)
+{
+    struct rtsp_sess *sessp = NULL;
+
+    if (!usr_id) {
+        printd(ERR "Illegal user ID!\n");
+        return -1;
+    }
+    sessp = usr_sess(usr_id);
+
+    if (!sessp->shm_ring) {
+        printd(ERR "Channel without shm ring!\n");
+        return -1;
+    }
+    return sessp->shm_ring->fd;
+}
+
+int set_store_frms(store_frms_t store_frms)
+{
+    rtsp_cli.store_frms = store_frms;
+    return 0;
+}
+
+unsigned long start_rec(unsigned long usr_id, const char *path)
+{
+    struct rtsp_sess *sessp = NULL;
+    struct recorder *recp = NULL;
+    struct rtsp_sub *subp = NULL;
+
+    if (!usr_id || !path) {
+        printd(ERR "Illegal user ID or path!\n");
+        return 0;
+    }
+    sessp = usr_sess(usr_id);
+    if (sessp->chn_info.flags & CHN_FLAG_PULL) {
+        printd(ERR "Channel in pull mode can't be recorded!\n");
+        return 0;
+    }
+
+    recp = create_recorder(sessp, path);
+    if (!recp) {
+        return 0;
+    }
+
+    /* The recorder keeps the session, like a channel. */
+    pthread_mutex_lock(&rtsp_cli.list_mutex);
+    sessp->ref++;
+    pthread_mutex_unlock(&rtsp_cli.list_mutex);
+    subp = add_rtsp_sub(sessp, &sessp->chn_info, recp);
+    if (!subp) {
+        put_rtsp_sess(sessp);
+        destroy_recorder(recp);
+        return 0;
+    }
+    return (unsigned long)subp;
+}
+
+void stop_rec(unsigned long rec_id)
+{
+    struct recorder *recp = NULL;
+
+    if (!rec_id || !((struct rtsp_sub *)rec_id)->recp) {
+        printd(ERR "Illegal recorder ID!\n");
+        return;
+    }
+    recp = ((struct rtsp_sub *)rec_id)->recp;
+
+    close_chn(rec_id);
+    destroy_recorder(recp);
+    return;
+}
+
+int set_deliver_thrd_num(unsigned int num)
+{
+    struct deliver_pool *poolp = &rtsp_cli.deliver_pool;
+    int ret = 0;
+
+    if (!num || num > MAX_DELIVER_THRD_NUM) {
+        printd(ERR "Illegal number of deliver threads!\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&poolp->mutex);
+    if (poolp->started) {
+        printd(ERR "Deliver threads have been started!\n");
+        ret = -1;
+    } else {
+        poolp->thrd_num = num;
+    }
+    pthread_mutex_unlock(&poolp->mutex);
+    return ret;
+}
@@ -44,20 +44,15 @@ static const char *get_next_line(const char *str)
     return line;
 }
 
-struct sdp_info *alloc_sdp_info(void)
+static struct sdp_info *alloc_sdp_info(struct arena *ap)
 {
     struct sdp_info *sdp = NULL;
-    int i = 0;
 
-    sdp = mallocz(sizeof(*sdp));
+    sdp = alloc_from_arena(ap, sizeof(*sdp));
     if (!sdp) {
         printd("Allocate memory for struct sdp_info failed!\n");
         return NULL;
     }
-
-    for (i = 0; i < 2; i++) {
-        INIT_LIST_HEAD(&sdp->sdp_m[i].sdp_a_list);
-    }
     return sdp;
 }
 
@@ -67,14 +62,125 @@ void free_sdp_info(struct sdp_info *sdp)
     return;
 }
 
-static int parse_sdp_info(struct sdp_info *sdp, const char *line)
+/**
+ * Copy the string to the tail of the memory block of sdp_info.
+ */
+static char *copy_sdp_str(char **tail, const char *str)
+{
+    char *dup = NULL;
+
+    if (!str) {
+        return NULL;
+    }
+    dup = *tail;
+    strcpy(dup, str);
+    *tail += strlen(str) + 1;
+    return dup;
+}
+
+/**
+ * Make a compact copy of @sdp in one memory block
+ * sized to its contents, which may be freed by free_sdp_info().
+ */
+struct sdp_info *dup_sdp_info(const struct sdp_info *sdp)
 {
+    struct sdp_info *dup = NULL;
+    const struct sdp_m *m = NULL;
+    unsigned int sz = sizeof(*sdp);
+    char *tail = NULL;
     int i = 0;
+
+    for (i = 0; i < 2; i++) {
+        m = &sdp->sdp_m[i];
+        sz += m->proto ? strlen(m->proto) + 1 : 0;
+        sz += m->rtpmap.enc_name ? strlen(m->rtpmap.enc_name) + 1 : 0;
+        sz += m->control ? strlen(m->control) + 1 : 0;
+        sz += m->fmtp.profile_level_id ? strlen(m->fmtp.profile_level_id) + 1 : 0;
+        sz += m->fmtp.sprop_parameter_sets ? strlen(m->fmtp.sprop_parameter_sets) + 1 : 0;
+        sz += m->fmtp.sprop_vps ? strlen(m->fmtp.sprop_vps) + 1 : 0;
+        sz += m->fmtp.sprop_sps ? strlen(m->fmtp.sprop_sps) + 1 : 0;
+        sz += m->fmtp.sprop_pps ? strlen(m->fmtp.sprop_pps) + 1 : 0;
+    }
+
+    dup = malloc(sz);
+    if (!dup) {
+        printd(ERR "Allocate memory for struct sdp_info failed!\n");
+        return NULL;
+    }
+    memcpy(dup, sdp, sizeof(*sdp));
+    dup->sz = sz;
+
+    tail = (char *)(dup + 1);
+    for (i = 0; i < 2; i++) {
+        m = &sdp->sdp_m[i];
+        dup->sdp_m[i].proto = copy_sdp_str(&tail, m->proto);
+        dup->sdp_m[i].rtpmap.enc_name = copy_sdp_str(&tail, m->rtpmap.enc_name);
+        dup->sdp_m[i].control = copy_sdp_str(&tail, m->control);
+        dup->sdp_m[i].fmtp.profile_level_id =
+            copy_sdp_str(&tail, m->fmtp.profile_level_id);
+        dup->sdp_m[i].fmtp.sprop_parameter_sets =
+            copy_sdp_str(&tail, m->fmtp.sprop_parameter_sets);
+        dup->sdp_m[i].fmtp.sprop_vps = copy_sdp_str(&tail, m->fmtp.sprop_vps);
+        dup->sdp_m[i].fmtp.sprop_sps = copy_sdp_str(&tail, m->fmtp.sprop_sps);
+        dup->sdp_m[i].fmtp.sprop_pps = copy_sdp_str(&tail, m->fmtp.sprop_pps);
+    }
+    return dup;
+}
+
+/**
+ * Parse the format specific parameters, like this:
+ * `a=fmtp:96 packetization-mode=1;profile-level-id=42001e;sprop-parameter-sets=Z0IA,aM4='
+ * `a=fmtp:96 sprop-vps=QAEM;sprop-sps=QgEB;sprop-pps=RAHA'
+ */
+static int parse_sdp_fmtp(struct arena *ap, struct fmtp *fmtp, const char *line)
+{
+    const char *ptr = NULL;
+    const char *val = NULL;
+    const char *end = NULL;
+    int start = 0;
+
+    if (sscanf(line, "a=fmtp:%d %n", (int *)&fmtp->pt, &start) != 1) {
+        return -1;
+    }
+
+    ptr = line + start;
+    while (*ptr && *ptr != '\r' && *ptr != '\n') {
+        while (*ptr == ' ' || *ptr == ';') {
+            ptr++;
+        }
+        end = strpbrk(ptr, ";\r\n");
+        if (!end) {
+            end = ptr + strlen(ptr);
+        }
+        val = memchr(ptr, '=', end - ptr);
+        if (val) {
+            val++;
+            if (!strncmp(ptr, "packetization-mode=", strlen("packetization-mode="))) {
+                fmtp->packetization_mode = atoi(val);
+            } else if (!strncmp(ptr, "profile-level-id=", strlen("profile-level-id="))) {
+                fmtp->profile_level_id = dup_str_to_arena(ap, val, end - val);
+            } else if (!strncmp(ptr, "sprop-parameter-sets=", strlen("sprop-parameter-sets="))) {
+                fmtp->sprop_parameter_sets = dup_str_to_arena(ap, val, end - val);
+            } else if (!strncmp(ptr, "sprop-vps=", strlen("sprop-vps="))) {
+                fmtp->sprop_vps = dup_str_to_arena(ap, val, end - val);
+            } else if (!strncmp(ptr, "sprop-sps=", strlen("sprop-sps="))) {
+                fmtp->sprop_sps = dup_str_to_arena(ap, val, end - val);
+            } else if (!strncmp(ptr, "sprop-pps=", strlen("sprop-pps="))) {
+                fmtp->sprop_pps = dup_str_to_arena(ap, val, end - val);
+            }
+        }
+        ptr = end;
+    }
+    return 0;
+}
+
+static int parse_sdp_info(struct arena *ap, struct sdp_info *sdp, const char *line)
+{
     int v = 0;
-    struct sdp_a *a = NULL;
     enum media_type media = 0;
-    struct sdp_a *sdp_a = NULL;
-    struct sdp_a *tmp = NULL;
+    struct sdp_m *m = NULL;
+    int start = 0;
+    int end = 0;
 
     while (line) {
         switch (line[0]) {
@@ -82,7 +188,7 @@ static int parse_sdp_info(struct sdp_info *sdp, const char *line)
             if (sscanf(line, "v=%d", &v) == 1) {
                 if (v) {        /* Current SDP version is zero. */
                     printd(WARNING "Wrong SDP version!\n");
-                    goto err;
+                    return -1;
                 }
             }
             break;
@@ -104,46 +210,53 @@ static int parse_sdp_info(struct sdp_info *sdp, const char *line)
                 break;
             }
 
-            sdp->sdp_m[media].enable = 1;
-            if (sscanf(line, "%*[^ ] %d %s %d",
-                       &sdp->sdp_m[media].port,
-                       sdp->sdp_m[media].proto,
-                       (int *)&sdp->sdp_m[media].pt) != 3) {
+            m = &sdp->sdp_m[media];
+            m->enable = 1;
+            if (sscanf(line, "%*[^ ] %d %n%*s%n %d",
+                       &m->port, &start, &end, (int *)&m->pt) != 2) {
                 printd(ERR "sscanf() for sdp_m line failed!\n");
-                goto err;
+                return -1;
+            }
+            m->proto = dup_str_to_arena(ap, line + start, end - start);
+            if (!m->proto) {
+                return -1;
             }
 
             /* Get the attribute corresponding with the media. */
             while (line) {
                 line = get_next_line(line);
+                if (!line) {
+                    break;
+                }
                 if (!strncmp(line, "a=rtpmap", strlen("a=rtpmap"))) {
-                    a = mallocz(sizeof(*a));
-                    if (!a) {
-                        printd(ERR "Allocate memory for struct sdp_a failed!\n");
-                        goto err;
-                    }
-                    memcpy(a->name, "rtpmap", strlen("rtpmap"));
-                    if (sscanf(line, "a=rtpmap:%d %[^/]/%d%*s",
-                               (int *)&a->rtpmap.pt,
-                               a->rtpmap.enc_name,
-                               &a->rtpmap.clk_rate) != 3) {
+                    if (sscanf(line, "a=rtpmap:%d %n%*[^/]%n/%u",
+                               (int *)&m->rtpmap.pt, &start, &end,
+                               &m->rtpmap.clk_rate) != 2) {
                         printd(ERR "sscanf() for sdp_a line failed!\n");
-                        goto err;
+                        return -1;
                     }
-                    list_add_tail(&a->entry, &sdp->sdp_m[media].sdp_a_list);
-                } else if (!strncmp(line, "a=control", strlen("a=control"))) {
-                    a = mallocz(sizeof(*a));
-                    if (!a) {
-                        printd(ERR "Allocate memory for struct sdp_a failed!\n");
-                        goto err;
+                    m->rtpmap.enc_name = dup_str_to_arena(ap, line + start, end - start);
+                    if (!m->rtpmap.enc_name) {
+                        return -1;
                     }
-                    memcpy(a->name, "control", strlen("control"));
-                    if (sscanf(line, "a=control:%s", a->control.track) != 1) {
+                } else if (!strncmp(line, "a=control", strlen("a=control"))) {
+                    if (sscanf(line, "a=control:%n%*s%n", &start, &end) != 0 ||
+                        end <= start) {
                         printd(ERR "sscanf() for sdp_a line failed!\n");
-                        goto err;
+                        return -1;
                     }
-                    list_add_tail(&a->entry, &sdp->sdp_m[media].sdp_a_list);
-                } else if (!strncmp(line, "b=AS", strlen("b=AS"))) {
+                    m->control = dup_str_to_arena(ap, line + start, end - start);
+                    if (!m->control) {
+                        return -1;
+                    }
+                } else if (!strncmp(line, "a=fmtp", strlen("a=fmtp"))) {
+                    if (parse_sdp_fmtp(ap, &m->fmtp, line) < 0) {
+                        printd(ERR "Parse sdp_a line fmtp failed!\n");
+                        return -1;
+                    }
+                } else if (!strncmp(line, "a=", strlen("a=")) ||
+                           !strncmp(line, "b=", strlen("b="))) {
+                    /* Not parse this line yet. */
                 } else {
                     /*
                      * Here we minus 1, so that the next call of
@@ -163,18 +276,9 @@ static int parse_sdp_info(struct sdp_info *sdp, const char *line)
         line = get_next_line(line);
     }
     return 0;
-
-err:
-    for (i = 0; i < 2; i++) {
-        list_for_each_entry_safe(sdp_a, tmp, &sdp->sdp_m[i].sdp_a_list, entry) {
-            list_del(&sdp_a->entry);
-            freez(sdp_a);
-        }
-    }
-    return -1;
 }
 
-static int parse_hdr_content(struct rtsp_resp *resp, const char *line)
+static int parse_hdr_content(struct arena *ap, struct rtsp_resp *resp, const char *line)
 {
     const char *ptr = NULL;
 
@@ -204,9 +308,10 @@ static int parse_hdr_content(struct rtsp_resp *resp, const char *line)
                 }
 
                 if (strstr(resp->resp_hdr.content_type, "sdp")) {
-                    resp->sdp_info = alloc_sdp_info();
-                    if (parse_sdp_info(resp->sdp_info, line) < 0) {
-                        free_sdp_info(resp->sdp_info);
+                    resp->sdp_info = alloc_sdp_info(ap);
+                    if (!resp->sdp_info ||
+                        parse_sdp_info(ap, resp->sdp_info, line) < 0) {
+                        resp->sdp_info = NULL;
                         return -1;
                     } else {
                         break;
@@ -296,9 +401,10 @@ static int parse_resp_line(struct rtsp_resp *resp, const char *line)
     return 0;
 }
 
-static int parse_resp_hdrs(struct rtsp_resp *resp, const char *line)
+static int parse_resp_hdrs(struct arena *ap, struct rtsp_resp *resp, const char *line)
 {
     int cseq_found = 0;
+    const char *ptr = NULL;
 
     while (line) {
         if (!strncasecmp(line, "CSeq", strlen("CSeq"))) {
@@ -317,6 +423,11 @@ static int parse_resp_hdrs(struct rtsp_resp *resp, const char *line)
                        &resp->resp_hdr.sess_id) != 1) {
                 return -1;
             }
+            /* Like this: `Session: 12345678;timeout=60'. */
+            ptr = strpbrk(line, ";\r\n");
+            if (ptr && *ptr == ';') {
+                sscanf(ptr, ";timeout=%u", &resp->resp_hdr.sess_timeout);
+            }
         } else if (!strncasecmp(line, "Public", strlen("Public"))) {
             if (sscanf(line + strlen("Public: "), "%[^\r\n]",
                        resp->resp_hdr.public) != 1) {
@@ -327,7 +438,7 @@ static int parse_resp_hdrs(struct rtsp_resp *resp, const char *line)
                 return -1;
             }
         } else if (!strncasecmp(line, "Content-Type", strlen("Content-Type"))) {
-            if (parse_hdr_content(resp, line) < 0) {
+            if (parse_hdr_content(ap, resp, line) < 0) {
                 return -1;
             } else {
                 break;
@@ -347,19 +458,21 @@ int parse_rtsp_resp(struct rtsp_sess *sessp, struct rtsp_resp *resp,
                     const char *msg, unsigned int sz)
 {
     const char *line = msg;
+    int ret = 0;
 
     print_rtsp_msg(msg, sz);
 
     /* Parse response line. */
-    if (parse_resp_line(resp, line) < 0) {
-        return -1;
-    }
+    ret = parse_resp_line(resp, line);
 
-    /* Parse response headers. */
+    /*
+     * Parse response headers even if the response line tells an error,
+     * the CSeq is needed to find out which request failed.
+     */
     line = get_next_line(line);
-    if (parse_resp_hdrs(resp, line) < 0) {
+    if (parse_resp_hdrs(&sessp->arena, resp, line) < 0) {
         return -1;
     }
 
-    return 0;
+    return ret;
 }
@@ -9,6 +9,9 @@
 #define __PARSER_H__
 
 
+struct sdp_info *dup_sdp_info(const struct sdp_info *sdp);
+void free_sdp_info(struct sdp_info *sdp);
+
 int parse_rtsp_resp(struct rtsp_sess *sessp, struct rtsp_resp *resp,
                     const char *msg, unsigned int sz);
 
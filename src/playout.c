@@ -0,0 +1,226 @@
+/*********************************************************************
+ * File Name    : playout.c
+ * Description  : Pass frames on to user at the pace of
+ *                their RTP timestamps.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-02-26
+ ********************************************************************/
+
+#include <stdio.h>
+#include <errno.h>
+#include "log.h"
+#include "util.h"
+#include "rtsp_cli.h"
+#include "playout.h"
+
+static void *playout_thrd(void *arg)
+{
+    struct playout *pop = arg;
+    struct frm_copy *frmp = NULL;
+    struct timespec ts;
+    unsigned long long now = 0;
+
+    pthread_mutex_lock(&pop->mutex);
+    while (pop->running) {
+        if (list_empty(&pop->frm_list)) {
+            pthread_cond_wait(&pop->cond, &pop->mutex);
+            continue;
+        }
+
+        frmp = list_first_entry(&pop->frm_list, struct frm_copy, entry);
+        now = time_now();
+        if (frmp->due > now) {
+            ts.tv_sec = frmp->due / MILLION;
+            ts.tv_nsec = (frmp->due % MILLION) * THOUSAND;
+            pthread_cond_timedwait(&pop->cond, &pop->mutex, &ts);
+            continue;
+        }
+
+        /* Pass it on without the lock, drop_playout_frm() waits for us. */
+        list_del(&frmp->entry);
+        pop->busy = frmp->sessp;
+        pthread_mutex_unlock(&pop->mutex);
+
+        if (frmp->sessp->deliver_ring) {
+            put_deliver_ring(frmp->sessp->deliver_ring, frmp);    /* pull mode */
+        } else {
+            store_sess_frm(frmp->sessp, &frmp->frm_info);
+            freez(frmp);
+        }
+
+        pthread_mutex_lock(&pop->mutex);
+        pop->busy = NULL;
+        pthread_cond_broadcast(&pop->cond);
+    }
+    pthread_mutex_unlock(&pop->mutex);
+    return NULL;
+}
+
+void init_playout(struct playout *pop)
+{
+    INIT_LIST_HEAD(&pop->frm_list);
+    pthread_mutex_init(&pop->mutex, NULL);
+    pthread_cond_init(&pop->cond, NULL);
+    pop->running = 0;
+    pop->busy = NULL;
+    return;
+}
+
+void deinit_playout(struct playout *pop)
+{
+    struct frm_copy *frmp = NULL;
+    struct frm_copy *tmp = NULL;
+    int running = 0;
+
+    pthread_mutex_lock(&pop->mutex);
+    running = pop->running;
+    pop->running = 0;
+    pthread_cond_broadcast(&pop->cond);
+    pthread_mutex_unlock(&pop->mutex);
+
+    if (running) {
+        pthread_join(pop->tid, NULL);
+    }
+
+    list_for_each_entry_safe(frmp, tmp, &pop->frm_list, entry) {
+        list_del(&frmp->entry);
+        freez(frmp);
+    }
+    pthread_cond_destroy(&pop->cond);
+    pthread_mutex_destroy(&pop->mutex);
+    return;
+}
+
+/**
+ * Get the time to pass the frame on, and adapt the delay to jitter.
+ */
+static unsigned long long get_due_time(struct rtsp_sess *sessp, struct playout_clk *clkp,
+                                       unsigned int ts, unsigned int clk_rate)
+{
+    unsigned long long now = time_now();
+    unsigned long long max_delay = 0;
+    unsigned long long due = 0;
+    long long offset = 0;       /* us, media time from base */
+    long long transit = 0;      /* us, over the base */
+    long long d = 0;
+    unsigned int target = 0;
+
+    max_delay = (unsigned long long)(sessp->chn_info.max_delay ?
+                                     sessp->chn_info.max_delay : DFL_PLAYOUT_DELAY) * THOUSAND;
+
+    offset = (long long)(int)(ts - clkp->base_ts) * MILLION / clk_rate;
+    if (!clkp->active || offset > MAX_PLAYOUT_JUMP * MILLION ||
+        offset < -MAX_PLAYOUT_JUMP * MILLION) {
+        memset(clkp, 0, sizeof(*clkp));
+        clkp->active = 1;
+        clkp->base_ts = ts;
+        clkp->base_time = now;
+        offset = 0;
+    }
+
+    transit = (long long)(now - clkp->base_time) - offset;
+    if (transit < 0) {
+        /* Arrived faster than the base, it's the new base. */
+        clkp->base_time += transit;
+        clkp->last_transit -= transit;
+        transit = 0;
+    } else if (transit > (long long)(2 * max_delay)) {
+        /* Clock drift or stall, start over from this frame. */
+        clkp->base_time = now - offset;
+        clkp->last_transit = 0;
+        transit = 0;
+    }
+
+    d = transit - clkp->last_transit;
+    d = d < 0 ? -d : d;
+    clkp->jitter += (d - (long long)clkp->jitter) / 16;
+    clkp->last_transit = transit;
+
+    target = PLAYOUT_JITTER_MUL * clkp->jitter;
+    if (target > max_delay) {
+        target = max_delay;
+    }
+    clkp->delay += ((long long)target - clkp->delay) / 8;
+
+    due = clkp->base_time + offset + clkp->delay;
+    if (due < clkp->last_due) {
+        due = clkp->last_due;
+    }
+    if (due > now + max_delay) {
+        due = now + max_delay;
+    }
+    clkp->last_due = due;
+    return due;
+}
+
+/**
+ * Copy the frame, and queue it to be passed on by the timer thread.
+ * Return -1 if the caller should pass it on itself.
+ */
+int put_playout_frm(struct rtsp_sess *sessp, struct playout_clk *clkp,
+                    const struct frm_info *frmp, unsigned int clk_rate)
+{
+    struct playout *pop = &rtsp_cli.playout;
+    struct frm_copy *pfp = NULL;
+    struct frm_copy *pos = NULL;
+    int ret = 0;
+
+    if (!clk_rate) {
+        return -1;
+    }
+
+    pfp = copy_frm(sessp, frmp);
+    if (!pfp) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&pop->mutex);
+    if (!pop->running) {
+        if ((ret = pthread_create(&pop->tid, NULL, playout_thrd, pop)) != 0) {
+            pthread_mutex_unlock(&pop->mutex);
+            printd(ERR "Create thread playout_thrd error: %s\n", strerror(ret));
+            freez(pfp);
+            return -1;
+        }
+        pop->running = 1;
+    }
+
+    pfp->due = get_due_time(sessp, clkp, frmp->ts, clk_rate);
+
+    /* Most frames go to the tail. */
+    list_for_each_entry_reverse(pos, &pop->frm_list, entry) {
+        if (pos->due <= pfp->due) {
+            break;
+        }
+    }
+    list_add(&pfp->entry, &pos->entry);
+    if (pop->frm_list.next == &pfp->entry) {
+        pthread_cond_broadcast(&pop->cond);
+    }
+    pthread_mutex_unlock(&pop->mutex);
+    return 0;
+}
+
+/**
+ * Drop frames of the session, and wait for the one being passed on.
+ * Must be called before the session is freed.
+ */
+void drop_playout_frm(struct rtsp_sess *sessp)
+{
+    struct playout *pop = &rtsp_cli.playout;
+    struct frm_copy *pfp = NULL;
+    struct frm_copy *tmp = NULL;
+
+    pthread_mutex_lock(&pop->mutex);
+    list_for_each_entry_safe(pfp, tmp, &pop->frm_list, entry) {
+        if (pfp->sessp == sessp) {
+            list_del(&pfp->entry);
+            freez(pfp);
+        }
+    }
+    while (pop->busy == sessp) {
+        pthread_cond_wait(&pop->cond, &pop->mutex);
+    }
+    pthread_mutex_unlock(&pop->mutex);
+    return;
+}
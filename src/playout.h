@@ -0,0 +1,55 @@
+/*********************************************************************
+ * File Name    : playout.h
+ * Description  : Pass frames on to user at the pace of
+ *                their RTP timestamps.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-02-26
+ ********************************************************************/
+
+#ifndef __PLAYOUT_H__
+#define __PLAYOUT_H__
+
+
+#include <pthread.h>
+#include "list.h"
+#include "librtspcli.h"
+#include "deliver.h"
+
+#define DFL_PLAYOUT_DELAY   200     /* ms, default bound of playout delay */
+#define PLAYOUT_JITTER_MUL  3       /* playout delay follows jitter times this */
+#define MAX_PLAYOUT_JUMP    10      /* second(s), timestamp jump larger than this resets clock */
+
+/*
+ * Playout clock of one media, maps RTP timestamp to local time.
+ * The base is the frame arrived with the least transit time,
+ * other frames are delayed by delay(us) after their base time.
+ */
+struct playout_clk {
+    int active;
+    unsigned int base_ts;           /* RTP timestamp of base */
+    unsigned long long base_time;   /* local time(us) of base */
+    long long last_transit;         /* transit time(us) of last frame over the base */
+    unsigned int jitter;            /* us, smoothed as RFC 3550 */
+    unsigned int delay;             /* us, follows jitter, bounded */
+    unsigned long long last_due;    /* frames of one media never pass each other */
+};
+
+/* One timer thread serves all channels. */
+struct playout {
+    struct list_head frm_list;      /* sorted by due time */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t tid;
+    int running;                    /* the thread is started when needed */
+    struct rtsp_sess *busy;         /* session whose frame is being passed on */
+};
+
+struct rtsp_sess;
+void init_playout(struct playout *pop);
+void deinit_playout(struct playout *pop);
+int put_playout_frm(struct rtsp_sess *sessp, struct playout_clk *clkp,
+                    const struct frm_info *frmp, unsigned int clk_rate);
+void drop_playout_frm(struct rtsp_sess *sessp);
+
+
+#endif /* __PLAYOUT_H__ */
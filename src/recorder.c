@@ -0,0 +1,761 @@
+/*********************************************************************
+ * File Name    : recorder.c
+ * Description  : Record video of a channel into a fragmented MP4
+ *                file, one fragment per GOP. Data is appended to
+ *                large aligned buffers, which are written with
+ *                O_DIRECT by a few threads shared by all recorders,
+ *                and the file is preallocated in chunks.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-03-11
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "log.h"
+#include "util.h"
+#include "rtsp_cli.h"
+#include "recorder.h"
+
+
+#define MAX_INIT_SEG_SZ     (MAX_CODEC_CFG_SZ + 1024)
+#define MAX_MOOF_SZ         (128 + MAX_REC_SAMPLE_NUM * 12)
+
+#define SAMPLE_FLAG_SYNC    0x02000000  /* sample_depends_on: 2 */
+#define SAMPLE_FLAG_NONSYNC 0x01010000  /* sample_depends_on: 1, sample_is_non_sync_sample */
+#define SAMPLE_FLAG_NONREF  0x00800000  /* sample_is_depended_on: 2 */
+
+static const unsigned char unity_matrix[36] = {
+    0x00, 0x01, 0x00, 0x00, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0x00, 0x01, 0x00, 0x00, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0x40, 0x00, 0x00, 0x00,
+};
+
+static inline char *put_be16(char *ptr, unsigned int val)
+{
+    *ptr++ = (val >> 8) & 0xFF;
+    *ptr++ = val & 0xFF;
+    return ptr;
+}
+
+static inline char *put_be32(char *ptr, unsigned int val)
+{
+    *ptr++ = (val >> 24) & 0xFF;
+    *ptr++ = (val >> 16) & 0xFF;
+    *ptr++ = (val >> 8) & 0xFF;
+    *ptr++ = val & 0xFF;
+    return ptr;
+}
+
+static inline char *put_zero(char *ptr, unsigned int sz)
+{
+    memset(ptr, 0, sz);
+    return ptr + sz;
+}
+
+/* Start a box, its size is filled in by end_box(). */
+static inline char *begin_box(char *ptr, const char *type)
+{
+    ptr = put_be32(ptr, 0);
+    memcpy(ptr, type, 4);
+    return ptr + 4;
+}
+
+static inline char *begin_full_box(char *ptr, const char *type,
+                                   unsigned int ver, unsigned int flags)
+{
+    ptr = begin_box(ptr, type);
+    return put_be32(ptr, (ver << 24) | flags);
+}
+
+static inline void end_box(char *box, char *end)
+{
+    put_be32(box, end - box);
+    return;
+}
+
+/**
+ * Sample entry avc3/hev1, parameter sets may also come in band.
+ */
+static char *put_sample_entry(char *ptr, enum video_codec codec,
+                              const char *cfg, unsigned int cfg_sz,
+                              unsigned int width, unsigned int height)
+{
+    char *entry = ptr;
+    char *box = NULL;
+
+    ptr = begin_box(ptr, codec == VIDEO_CODEC_H265 ? "hev1" : "avc3");
+    ptr = put_zero(ptr, 6);
+    ptr = put_be16(ptr, 1);         /* data_reference_index */
+    ptr = put_zero(ptr, 16);
+    ptr = put_be16(ptr, width);
+    ptr = put_be16(ptr, height);
+    ptr = put_be32(ptr, 0x00480000);    /* 72 dpi */
+    ptr = put_be32(ptr, 0x00480000);
+    ptr = put_be32(ptr, 0);
+    ptr = put_be16(ptr, 1);         /* frame_count */
+    ptr = put_zero(ptr, 32);        /* compressorname */
+    ptr = put_be16(ptr, 0x0018);    /* depth */
+    ptr = put_be16(ptr, 0xFFFF);
+
+    box = ptr;
+    ptr = begin_box(ptr, codec == VIDEO_CODEC_H265 ? "hvcC" : "avcC");
+    memcpy(ptr, cfg, cfg_sz);
+    ptr += cfg_sz;
+    end_box(box, ptr);
+    end_box(entry, ptr);
+    return ptr;
+}
+
+/**
+ * ftyp & moov of one video track, without samples.
+ */
+static int make_init_seg(char *buf, enum video_codec codec,
+                         const char *cfg, unsigned int cfg_sz,
+                         unsigned int width, unsigned int height)
+{
+    static const char *empty_tables[] = {"stts", "stsc", "stco"};
+    char *box[8];
+    char *ptr = buf;
+    unsigned int i = 0;
+
+    box[0] = ptr;
+    ptr = begin_box(ptr, "ftyp");
+    memcpy(ptr, "isom", 4);
+    ptr = put_be32(ptr + 4, 0x200);
+    memcpy(ptr, "isomiso6mp41", 12);
+    ptr += 12;
+    end_box(box[0], ptr);
+
+    box[0] = ptr;
+    ptr = begin_box(ptr, "moov");
+
+    box[1] = ptr;
+    ptr = begin_full_box(ptr, "mvhd", 0, 0);
+    ptr = put_zero(ptr, 8);         /* creation & modification time */
+    ptr = put_be32(ptr, 1000);      /* timescale */
+    ptr = put_be32(ptr, 0);         /* duration */
+    ptr = put_be32(ptr, 0x00010000);    /* rate */
+    ptr = put_be16(ptr, 0x0100);    /* volume */
+    ptr = put_zero(ptr, 10);
+    memcpy(ptr, unity_matrix, sizeof(unity_matrix));
+    ptr = put_zero(ptr + sizeof(unity_matrix), 24);
+    ptr = put_be32(ptr, 2);         /* next_track_ID */
+    end_box(box[1], ptr);
+
+    box[1] = ptr;
+    ptr = begin_box(ptr, "trak");
+    box[2] = ptr;
+    ptr = begin_full_box(ptr, "tkhd", 0, 0x03);     /* enabled, in movie */
+    ptr = put_zero(ptr, 8);
+    ptr = put_be32(ptr, 1);         /* track_ID */
+    ptr = put_zero(ptr, 4);
+    ptr = put_be32(ptr, 0);         /* duration */
+    ptr = put_zero(ptr, 16);        /* reserved, layer, alternate_group, volume, reserved */
+    memcpy(ptr, unity_matrix, sizeof(unity_matrix));
+    ptr += sizeof(unity_matrix);
+    ptr = put_be32(ptr, width << 16);
+    ptr = put_be32(ptr, height << 16);
+    end_box(box[2], ptr);
+
+    box[2] = ptr;
+    ptr = begin_box(ptr, "mdia");
+    box[3] = ptr;
+    ptr = begin_full_box(ptr, "mdhd", 0, 0);
+    ptr = put_zero(ptr, 8);
+    ptr = put_be32(ptr, REC_TIMESCALE);
+    ptr = put_be32(ptr, 0);
+    ptr = put_be16(ptr, 0x55C4);    /* und */
+    ptr = put_be16(ptr, 0);
+    end_box(box[3], ptr);
+
+    box[3] = ptr;
+    ptr = begin_full_box(ptr, "hdlr", 0, 0);
+    ptr = put_be32(ptr, 0);
+    memcpy(ptr, "vide", 4);
+    ptr = put_zero(ptr + 4, 12);
+    memcpy(ptr, "VideoHandler", sizeof("VideoHandler"));
+    ptr += sizeof("VideoHandler");
+    end_box(box[3], ptr);
+
+    box[3] = ptr;
+    ptr = begin_box(ptr, "minf");
+    box[4] = ptr;
+    ptr = begin_full_box(ptr, "vmhd", 0, 0x01);
+    ptr = put_zero(ptr, 8);
+    end_box(box[4], ptr);
+
+    box[4] = ptr;
+    ptr = begin_box(ptr, "dinf");
+    box[5] = ptr;
+    ptr = begin_full_box(ptr, "dref", 0, 0);
+    ptr = put_be32(ptr, 1);
+    box[6] = ptr;
+    ptr = begin_full_box(ptr, "url ", 0, 0x01);     /* in the same file */
+    end_box(box[6], ptr);
+    end_box(box[5], ptr);
+    end_box(box[4], ptr);
+
+    box[4] = ptr;
+    ptr = begin_box(ptr, "stbl");
+    box[5] = ptr;
+    ptr = begin_full_box(ptr, "stsd", 0, 0);
+    ptr = put_be32(ptr, 1);
+    ptr = put_sample_entry(ptr, codec, cfg, cfg_sz, width, height);
+    end_box(box[5], ptr);
+    for (i = 0; i < sizeof(empty_tables) / sizeof(empty_tables[0]); i++) {
+        box[5] = ptr;
+        ptr = begin_full_box(ptr, empty_tables[i], 0, 0);
+        ptr = put_be32(ptr, 0);
+        end_box(box[5], ptr);
+    }
+    box[5] = ptr;
+    ptr = begin_full_box(ptr, "stsz", 0, 0);
+    ptr = put_zero(ptr, 8);
+    end_box(box[5], ptr);
+    end_box(box[4], ptr);
+    end_box(box[3], ptr);
+    end_box(box[2], ptr);
+    end_box(box[1], ptr);
+
+    box[1] = ptr;
+    ptr = begin_box(ptr, "mvex");
+    box[2] = ptr;
+    ptr = begin_full_box(ptr, "trex", 0, 0);
+    ptr = put_be32(ptr, 1);         /* track_ID */
+    ptr = put_be32(ptr, 1);         /* default_sample_description_index */
+    ptr = put_zero(ptr, 12);
+    end_box(box[2], ptr);
+    end_box(box[1], ptr);
+    end_box(box[0], ptr);
+
+    return ptr - buf;
+}
+
+/**
+ * moof of the fragment, the duration of the last sample is
+ * up to the next frame, or the one before if there isn't any.
+ */
+static int make_moof(struct recorder *recp, int next_valid, unsigned int next_ts,
+                     unsigned long long *durp)
+{
+    struct rec_sample *sp = NULL;
+    char *box[3];
+    char *data_off = NULL;
+    char *ptr = recp->moof;
+    unsigned int dur = 0;
+    unsigned int i = 0;
+
+    box[0] = ptr;
+    ptr = begin_box(ptr, "moof");
+    box[1] = ptr;
+    ptr = begin_full_box(ptr, "mfhd", 0, 0);
+    ptr = put_be32(ptr, ++recp->seq);
+    end_box(box[1], ptr);
+
+    box[1] = ptr;
+    ptr = begin_box(ptr, "traf");
+    box[2] = ptr;
+    ptr = begin_full_box(ptr, "tfhd", 0, 0x020000);    /* default-base-is-moof */
+    ptr = put_be32(ptr, 1);
+    end_box(box[2], ptr);
+
+    box[2] = ptr;
+    ptr = begin_full_box(ptr, "tfdt", 1, 0);
+    ptr = put_be32(ptr, recp->dts >> 32);
+    ptr = put_be32(ptr, recp->dts & 0xFFFFFFFF);
+    end_box(box[2], ptr);
+
+    /* data-offset, sample-duration, sample-size, sample-flags */
+    box[2] = ptr;
+    ptr = begin_full_box(ptr, "trun", 0, 0x000701);
+    ptr = put_be32(ptr, recp->sample_num);
+    data_off = ptr;
+    ptr += 4;
+    *durp = 0;
+    for (i = 0; i < recp->sample_num; i++) {
+        sp = &recp->sample[i];
+        if (i + 1 < recp->sample_num) {
+            dur = sp[1].ts - sp->ts;
+        } else {
+            dur = next_valid ? next_ts - sp->ts : recp->last_dur;
+        }
+        /* RTP timestamp jumps, or goes back with B frames. */
+        if (!dur || dur > 10 * REC_TIMESCALE) {
+            dur = recp->last_dur;
+        }
+        recp->last_dur = dur;
+        *durp += dur;
+        ptr = put_be32(ptr, dur);
+        ptr = put_be32(ptr, sp->sz);
+        ptr = put_be32(ptr, sp->flags);
+    }
+    end_box(box[2], ptr);
+    end_box(box[1], ptr);
+    end_box(box[0], ptr);
+
+    put_be32(data_off, ptr - recp->moof + 8);   /* samples follow mdat header */
+    return ptr - recp->moof;
+}
+
+/**
+ * Queue the buffer being filled to writer, and take a free one.
+ * Must be called with mutex of writer held.
+ */
+static void queue_rec_buf(struct rec_writer *wp, struct recorder *recp)
+{
+    struct rec_buf *bufp = recp->cur;
+
+    list_add_tail(&bufp->entry, &wp->queue);
+    recp->pending++;
+    pthread_cond_signal(&wp->cond);
+
+    if (list_empty(&recp->free_list)) {
+        recp->cur = NULL;       /* the last one */
+        return;
+    }
+    bufp = list_first_entry(&recp->free_list, struct rec_buf, entry);
+    list_del(&bufp->entry);
+    recp->free_num--;
+    bufp->off = recp->file_sz;
+    bufp->sz = 0;
+    recp->cur = bufp;
+    return;
+}
+
+/**
+ * Append data to buffers, the caller has made sure they have room.
+ */
+static void append_rec(struct recorder *recp, const char *data, unsigned int sz)
+{
+    struct rec_writer *wp = &rtsp_cli.rec_writer;
+    unsigned int n = 0;
+
+    while (sz) {
+        n = REC_BUF_SZ - recp->cur->sz;
+        if (n > sz) {
+            n = sz;
+        }
+        memcpy(recp->cur->data + recp->cur->sz, data, n);
+        recp->cur->sz += n;
+        recp->file_sz += n;
+        data += n;
+        sz -= n;
+        if (recp->cur->sz == REC_BUF_SZ) {
+            pthread_mutex_lock(&wp->mutex);
+            queue_rec_buf(wp, recp);
+            pthread_mutex_unlock(&wp->mutex);
+        }
+    }
+    return;
+}
+
+/*
+ * Whether buffers have room for sz bytes, the writer may free some
+ * meanwhile. The buffer filled up by the last byte is queued, so
+ * one more free buffer is needed then.
+ */
+static int rec_room(struct recorder *recp, unsigned int sz)
+{
+    struct rec_writer *wp = &rtsp_cli.rec_writer;
+    unsigned long long room = 0;
+
+    pthread_mutex_lock(&wp->mutex);
+    room = REC_BUF_SZ - recp->cur->sz + (unsigned long long)recp->free_num * REC_BUF_SZ;
+    pthread_mutex_unlock(&wp->mutex);
+    return room > sz;
+}
+
+/**
+ * Make the fragment of samples so far and append it. If the disk
+ * falls behind, the fragment is dropped instead of blocking the
+ * session, the timeline still goes on. Fragments may start amid
+ * a GOP, so the rest of GOP is skipped as its references are gone.
+ */
+static void flush_fragment(struct recorder *recp, int next_valid, unsigned int next_ts)
+{
+    char mdat_hdr[8];
+    unsigned long long dur = 0;
+    int moof_sz = 0;
+
+    if (!recp->sample_num) {
+        return;
+    }
+
+    moof_sz = make_moof(recp, next_valid, next_ts, &dur);
+    if (rec_room(recp, moof_sz + sizeof(mdat_hdr) + recp->mdat_sz)) {
+        append_rec(recp, recp->moof, moof_sz);
+        put_be32(mdat_hdr, sizeof(mdat_hdr) + recp->mdat_sz);
+        memcpy(mdat_hdr + 4, "mdat", 4);
+        append_rec(recp, mdat_hdr, sizeof(mdat_hdr));
+        append_rec(recp, recp->mdat, recp->mdat_sz);
+    } else {
+        if (!recp->drop_num++) {
+            printd(WARNING "Disk falls behind, drop fragments of recorder!\n");
+        }
+        recp->seq--;
+        recp->gop_skip = 1;
+    }
+
+    recp->dts += dur;
+    recp->end_ts = next_ts;
+    recp->sample_num = 0;
+    recp->mdat_sz = 0;
+    return;
+}
+
+/**
+ * Make the init segment from parameter sets in the first key frame,
+ * they're always there in Annex B or AVCC form.
+ */
+static int start_rec_file(struct recorder *recp, const struct frm_info *frmp)
+{
+    struct param_sets ps;
+    const char *frm = frmp->frm_buf + recp->frm_hdr_sz;
+    const struct nalu_info *np = NULL;
+    char cfg[MAX_CODEC_CFG_SZ];
+    char seg[MAX_INIT_SEG_SZ];
+    unsigned int width = 0;
+    unsigned int height = 0;
+    unsigned int i = 0;
+    int cfg_sz = 0;
+    int is_ps = 0;
+
+    recp->codec = recp->sessp->video_codec;
+    memset(&ps, 0, sizeof(ps));
+    for (i = 0; frmp->nalu && i < frmp->nalu_num; i++) {
+        np = &frmp->nalu[i];
+        if (recp->codec == VIDEO_CODEC_H265) {
+            is_ps = np->type >= HEVC_NALU_TYPE_VPS && np->type <= HEVC_NALU_TYPE_PPS;
+        } else {
+            is_ps = np->type == NALU_TYPE_SPS || np->type == NALU_TYPE_PPS;
+        }
+        if (!is_ps || ps.num == MAX_PARAM_SET_NUM || ps.sz + np->sz > sizeof(ps.buf)) {
+            continue;
+        }
+        ps.nalu[ps.num].off = ps.sz;
+        ps.nalu[ps.num].sz = np->sz;
+        memcpy(ps.buf + ps.sz, frm + np->off, np->sz);
+        ps.sz += np->sz;
+        ps.num++;
+    }
+
+    cfg_sz = build_codec_cfg(recp->codec, &ps, cfg, sizeof(cfg));
+    if (cfg_sz < 0 || get_pic_size(recp->codec, &ps, &width, &height) < 0) {
+        if (!recp->cfg_err++) {
+            printd(WARNING "No parameter sets in key frame, wait for the next one!\n");
+        }
+        return -1;
+    }
+
+    append_rec(recp, seg, make_init_seg(seg, recp->codec, cfg, cfg_sz, width, height));
+    return 0;
+}
+
+/**
+ * Add the frame, or a part of it, to the fragment as sample data,
+ * NALUs are prefixed with their length. In AVCC mode they already are.
+ */
+static int add_sample_data(struct recorder *recp, const struct frm_info *frmp)
+{
+    const char *frm = frmp->frm_buf + recp->frm_hdr_sz;
+    const struct nalu_info *np = NULL;
+    char *ptr = recp->mdat + recp->mdat_sz;
+    unsigned int sz = 0;
+    unsigned int i = 0;
+
+    if (recp->avcc) {
+        sz = frmp->frm_sz;
+    } else if (frmp->nalu) {
+        for (i = 0; i < frmp->nalu_num; i++) {
+            sz += NALU_LEN_SZ + frmp->nalu[i].sz;
+        }
+    } else {
+        return -1;
+    }
+    if (recp->mdat_sz + sz > REC_MDAT_SZ) {
+        return -1;
+    }
+
+    if (recp->avcc) {
+        memcpy(ptr, frm, sz);
+    }
+    for (i = 0; !recp->avcc && i < frmp->nalu_num; i++) {
+        np = &frmp->nalu[i];
+        ptr = put_be32(ptr, np->sz);
+        memcpy(ptr, frm + np->off, np->sz);
+        ptr += np->sz;
+    }
+    recp->mdat_sz += sz;
+    recp->sample[recp->sample_num - 1].sz += sz;
+    return 0;
+}
+
+/**
+ * Put a video frame into the recording, a fragment is made at
+ * every key frame. Called under sub_mutex of the session.
+ */
+void put_rec_frm(struct recorder *recp, const struct frm_info *frmp)
+{
+    struct rec_sample *sp = NULL;
+    int key = (frmp->frm_type == FRM_TYPE_IF);
+
+    if (frmp->frm_type == FRM_TYPE_AF) {
+        return;
+    }
+
+    if (frmp->flags & FRM_FLAG_START) {
+        if (key) {
+            flush_fragment(recp, 1, frmp->ts);
+            if (recp->gop_skip && (int)(frmp->ts - recp->end_ts) > 0) {
+                recp->dts += frmp->ts - recp->end_ts;   /* frames skipped still take time */
+            }
+            recp->gop_skip = 0;
+            if (!recp->started && start_rec_file(recp, frmp) == 0) {
+                recp->started = 1;
+            }
+        } else if (recp->mdat_sz >= REC_FRAG_MARK ||
+                   recp->sample_num == MAX_REC_SAMPLE_NUM) {
+            flush_fragment(recp, 1, frmp->ts);
+        }
+        recp->frm_skip = 0;
+        if (!recp->started || recp->gop_skip) {
+            recp->frm_skip = 1;
+            return;
+        }
+
+        sp = &recp->sample[recp->sample_num++];
+        sp->ts = frmp->ts;
+        sp->sz = 0;
+        if (key) {
+            sp->flags = SAMPLE_FLAG_SYNC;
+        } else {
+            sp->flags = SAMPLE_FLAG_NONSYNC;
+            if (frmp->flags & FRM_FLAG_NONREF) {
+                sp->flags |= SAMPLE_FLAG_NONREF;
+            }
+        }
+    }
+    if (recp->frm_skip) {
+        return;
+    }
+
+    if (add_sample_data(recp, frmp) < 0) {
+        /* Too many NALUs to index, or too large. */
+        printd(WARNING "Frame can't be recorded, skip the rest of GOP!\n");
+        recp->sample_num--;
+        recp->mdat_sz -= recp->sample[recp->sample_num].sz;
+        recp->frm_skip = 1;
+        recp->gop_skip = 1;
+    }
+    return;
+}
+
+/**
+ * Write buffers queued by recorders, the file is preallocated
+ * ahead of them.
+ */
+static void *rec_writer_thrd(void *arg)
+{
+    struct rec_writer *wp = arg;
+    struct rec_buf *bufp = NULL;
+    struct recorder *recp = NULL;
+    unsigned long long end = 0;
+    unsigned int sz = 0;
+    ssize_t ret = 0;
+
+    pthread_mutex_lock(&wp->mutex);
+    while (1) {
+        while (wp->running && list_empty(&wp->queue)) {
+            pthread_cond_wait(&wp->cond, &wp->mutex);
+        }
+        if (list_empty(&wp->queue)) {
+            break;
+        }
+        bufp = list_first_entry(&wp->queue, struct rec_buf, entry);
+        list_del(&bufp->entry);
+        recp = bufp->recp;
+        pthread_mutex_unlock(&wp->mutex);
+
+        /* The last buffer is padded to the block size, then truncated. */
+        sz = (bufp->sz + REC_ALIGN - 1) & ~(REC_ALIGN - 1);
+        memset(bufp->data + bufp->sz, 0, sz - bufp->sz);
+        end = bufp->off + sz;
+        if (end > __atomic_load_n(&recp->alloc_sz, __ATOMIC_RELAXED)) {
+            if (fallocate(recp->fd, FALLOC_FL_KEEP_SIZE, bufp->off,
+                          REC_PREALLOC_SZ) == 0) {
+                __atomic_store_n(&recp->alloc_sz, bufp->off + REC_PREALLOC_SZ,
+                                 __ATOMIC_RELAXED);
+            }
+        }
+        if (!recp->write_err) {
+            ret = pwrite(recp->fd, bufp->data, sz, bufp->off);
+            if (ret != sz) {
+                printd(ERR "Write record error: %s\n", ret < 0 ? strerror(errno) : "short write");
+                recp->write_err = 1;
+            }
+        }
+
+        pthread_mutex_lock(&wp->mutex);
+        list_add_tail(&bufp->entry, &recp->free_list);
+        recp->free_num++;
+        recp->pending--;
+        pthread_cond_broadcast(&wp->done);
+    }
+    pthread_mutex_unlock(&wp->mutex);
+    return NULL;
+}
+
+void init_rec_writer(struct rec_writer *wp)
+{
+    memset(wp, 0, sizeof(*wp));
+    pthread_mutex_init(&wp->mutex, NULL);
+    pthread_cond_init(&wp->cond, NULL);
+    pthread_cond_init(&wp->done, NULL);
+    INIT_LIST_HEAD(&wp->queue);
+    return;
+}
+
+void deinit_rec_writer(struct rec_writer *wp)
+{
+    unsigned int i = 0;
+
+    pthread_mutex_lock(&wp->mutex);
+    wp->running = 0;
+    pthread_cond_broadcast(&wp->cond);
+    pthread_mutex_unlock(&wp->mutex);
+    for (i = 0; i < wp->started; i++) {
+        pthread_join(wp->tid[i], NULL);
+    }
+    wp->started = 0;
+
+    pthread_cond_destroy(&wp->done);
+    pthread_cond_destroy(&wp->cond);
+    pthread_mutex_destroy(&wp->mutex);
+    return;
+}
+
+/* Must be called with wp->mutex held. */
+static int start_rec_writer(struct rec_writer *wp)
+{
+    int ret = 0;
+
+    wp->running = 1;
+    while (wp->started < REC_WRITER_THRD_NUM) {
+        if ((ret = pthread_create(&wp->tid[wp->started], NULL, rec_writer_thrd, wp)) != 0) {
+            printd(ERR "Create thread rec_writer_thrd error: %s\n", strerror(ret));
+            break;
+        }
+        wp->started++;
+    }
+    return wp->started ? 0 : -1;
+}
+
+static void free_recorder(struct recorder *recp)
+{
+    unsigned int i = 0;
+
+    for (i = 0; i < REC_BUF_NUM; i++) {
+        freez(recp->buf[i].data);
+    }
+    freez(recp->moof);
+    freez(recp->mdat);
+    freez(recp);
+    return;
+}
+
+/**
+ * Open the file with O_DIRECT, page cache isn't used.
+ * It falls back to buffered writes on file systems without it.
+ */
+struct recorder *create_recorder(struct rtsp_sess *sessp, const char *path)
+{
+    struct rec_writer *wp = &rtsp_cli.rec_writer;
+    struct recorder *recp = NULL;
+    void *p = NULL;
+    unsigned int i = 0;
+    int ret = 0;
+
+    recp = mallocz(sizeof(*recp));
+    if (!recp) {
+        printd(ERR "Allocate memory for recorder failed!\n");
+        return NULL;
+    }
+    recp->sessp = sessp;
+    recp->frm_hdr_sz = sessp->chn_info.frm_hdr_sz;
+    recp->avcc = !!(sessp->chn_info.flags & CHN_FLAG_AVCC);
+    recp->last_dur = REC_TIMESCALE / 25;
+    recp->frm_skip = 1;
+    INIT_LIST_HEAD(&recp->free_list);
+    recp->mdat = malloc(REC_MDAT_SZ);
+    recp->moof = malloc(MAX_MOOF_SZ);
+    for (i = 0; i < REC_BUF_NUM; i++) {
+        if ((ret = posix_memalign(&p, REC_ALIGN, REC_BUF_SZ)) != 0) {
+            break;
+        }
+        recp->buf[i].recp = recp;
+        recp->buf[i].data = p;
+        list_add_tail(&recp->buf[i].entry, &recp->free_list);
+        recp->free_num++;
+    }
+    if (!recp->mdat || !recp->moof || i < REC_BUF_NUM) {
+        printd(ERR "Allocate buffers for recorder failed!\n");
+        free_recorder(recp);
+        return NULL;
+    }
+    recp->cur = list_first_entry(&recp->free_list, struct rec_buf, entry);
+    list_del(&recp->cur->entry);
+    recp->free_num--;
+
+    recp->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+    if (recp->fd < 0 && errno == EINVAL) {
+        recp->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (recp->fd < 0) {
+        printd(ERR "Open %s error: %s\n", path, strerror(errno));
+        free_recorder(recp);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&wp->mutex);
+    ret = start_rec_writer(wp);
+    pthread_mutex_unlock(&wp->mutex);
+    if (ret < 0) {
+        close(recp->fd);
+        free_recorder(recp);
+        return NULL;
+    }
+    return recp;
+}
+
+/**
+ * Make the last fragment, write what's left and cut the padding off.
+ * Frames mustn't be put any more.
+ */
+void destroy_recorder(struct recorder *recp)
+{
+    struct rec_writer *wp = &rtsp_cli.rec_writer;
+
+    flush_fragment(recp, 0, 0);
+
+    pthread_mutex_lock(&wp->mutex);
+    if (recp->cur && recp->cur->sz) {
+        queue_rec_buf(wp, recp);
+    }
+    while (recp->pending) {
+        pthread_cond_wait(&wp->done, &wp->mutex);
+    }
+    pthread_mutex_unlock(&wp->mutex);
+
+    if (ftruncate(recp->fd, recp->file_sz) < 0) {
+        printd(ERR "Truncate record error: %s\n", strerror(errno));
+    }
+    close(recp->fd);
+    if (recp->drop_num) {
+        printd(WARNING "%u fragments dropped while recording!\n", recp->drop_num);
+    }
+    free_recorder(recp);
+    return;
+}
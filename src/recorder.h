@@ -0,0 +1,99 @@
+/*********************************************************************
+ * File Name    : recorder.h
+ * Description  : Record video of a channel into a fragmented MP4
+ *                file, written in large aligned blocks.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-03-11
+ ********************************************************************/
+
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+
+#include <pthread.h>
+#include "list.h"
+#include "librtspcli.h"
+#include "rtp.h"
+
+#define REC_ALIGN           4096    /* alignment of O_DIRECT writes */
+#define REC_BUF_SZ          (256 * 1024)    /* written by one pwrite(), REC_ALIGN aligned */
+#define REC_BUF_NUM         8       /* buffers per recorder */
+#define REC_FRAG_MARK       (512 * 1024)    /* start a new fragment at a frame past it */
+#define REC_MDAT_SZ         (REC_FRAG_MARK + MAX_FRM_SZ + 64 * 1024)
+#define MAX_REC_SAMPLE_NUM  512     /* samples in a fragment */
+#define REC_PREALLOC_SZ     (16 * 1024 * 1024)  /* file grows by fallocate() in chunks */
+#define REC_WRITER_THRD_NUM 2
+#define REC_TIMESCALE       90000   /* RTP clock rate of video */
+
+/* buffer of file data, written once full */
+struct rec_buf {
+    struct list_head entry;         /* entry of free list, or queue of writer */
+    struct recorder *recp;
+    unsigned long long off;         /* file offset */
+    unsigned int sz;                /* bytes filled */
+    char *data;                     /* REC_BUF_SZ, REC_ALIGN aligned */
+};
+
+struct rec_sample {
+    unsigned int ts;                /* RTP timestamp */
+    unsigned int sz;
+    unsigned int flags;             /* sample_flags of trun */
+};
+
+struct rtsp_sess;
+
+/*
+ * A recorder joins the session as a subscriber, frames are put
+ * into the fragment under sub_mutex. A fragment(moof + mdat) is
+ * made at every key frame and appended to buffers, full buffers
+ * are written by the writer threads.
+ */
+struct recorder {
+    int fd;
+    struct rtsp_sess *sessp;
+    enum video_codec codec;         /* known once playing */
+    unsigned int frm_hdr_sz;
+    int avcc;                       /* frames come with length prefixes */
+    int started;                    /* init segment made */
+    unsigned int cfg_err;           /* key frames without parameter sets */
+    int gop_skip;                   /* part of GOP is lost, wait for key frame */
+    int frm_skip;                   /* the frame in parts is skipped */
+    unsigned int seq;               /* sequence number of fragment */
+    unsigned long long dts;         /* decode time of the fragment */
+    unsigned int end_ts;            /* RTP timestamp dts has reached */
+    unsigned int last_dur;
+    struct rec_sample sample[MAX_REC_SAMPLE_NUM];
+    unsigned int sample_num;
+    char *mdat;                     /* samples of the fragment, REC_MDAT_SZ */
+    unsigned int mdat_sz;
+    char *moof;
+    unsigned long long file_sz;     /* bytes appended to buffers */
+    unsigned long long alloc_sz;    /* bytes preallocated, by writer */
+    unsigned int drop_num;          /* fragments dropped for want of buffers */
+    struct rec_buf *cur;            /* buffer being filled */
+    struct list_head free_list;     /* protected by mutex of writer */
+    unsigned int free_num;
+    unsigned int pending;           /* buffers queued to writer */
+    int write_err;
+    struct rec_buf buf[REC_BUF_NUM];
+};
+
+/* Threads are started when the first recorder is created. */
+struct rec_writer {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;            /* buffers queued */
+    pthread_cond_t done;            /* buffers written */
+    struct list_head queue;
+    unsigned int started;
+    int running;
+    pthread_t tid[REC_WRITER_THRD_NUM];
+};
+
+void init_rec_writer(struct rec_writer *wp);
+void deinit_rec_writer(struct rec_writer *wp);
+struct recorder *create_recorder(struct rtsp_sess *sessp, const char *path);
+void destroy_recorder(struct recorder *recp);
+void put_rec_frm(struct recorder *recp, const struct frm_info *frmp);
+
+
+#endif /* __RECORDER_H__ */
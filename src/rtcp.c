@@ -5,14 +5,230 @@
  * Create Date  : 2012-12-26
  ********************************************************************/
 
+#include <stdio.h>
 #include "rtsp_cli.h"
 #include "rtcp.h"
+#include "send_queue.h"
 #include "log.h"
 
 
+#define RTP_SEQ_MOD     (1 << 16)
+#define RTCP_CNAME      "librtspcli"
+
+/* Common header of RTCP packets. */
+struct rtcp_hdr {
+#ifdef BIGENDIAN
+    unsigned char v:2;          /* protocol version */
+    unsigned char p:1;          /* padding flag */
+    unsigned char cnt:5;        /* varies by packet type */
+#else
+    unsigned char cnt:5;
+    unsigned char p:1;
+    unsigned char v:2;
+#endif
+    unsigned char pt;           /* RTCP packet type */
+    unsigned short len;         /* packet length in 32-bit words - 1 */
+};
+
+/**
+ * Refer to RFC3550 appendix A.1 & A.8, but we needn't probation here.
+ */
+void update_rtcp_stat(struct rtsp_sess *sessp, enum media_type media,
+                      const struct rtp_hdr *hdrp)
+{
+    struct rtcp_stat *statp = &sessp->rtcp_stat[media];
+    unsigned short seq = ntohs(hdrp->seq);
+    unsigned int clk_rate = 0;
+    unsigned long long now = 0;
+    int transit = 0;
+    int d = 0;
+
+    if (!statp->active) {
+        statp->active = 1;
+        statp->ssrc = ntohl(hdrp->ssrc);
+        statp->base_seq = seq;
+        statp->max_seq = seq;
+    } else if ((unsigned short)(seq - statp->max_seq) < RTP_SEQ_MOD / 2) {
+        if (seq < statp->max_seq) {  /* sequence number wrapped */
+            statp->cycles += RTP_SEQ_MOD;
+        }
+        statp->max_seq = seq;
+    }
+    statp->received++;
+
+    /* Interarrival jitter, in timestamp units. */
+    clk_rate = sessp->pt_map[media][hdrp->pt].clk_rate;
+    if (clk_rate) {
+        now = time_now() / THOUSAND;
+        transit = (int)(now * clk_rate / THOUSAND) - (int)ntohl(hdrp->ts);
+        if (statp->transit) {
+            d = transit - statp->transit;
+            d = d < 0 ? -d : d;
+            statp->jitter += d - ((statp->jitter + 8) >> 4);
+        }
+        statp->transit = transit;
+    }
+    return;
+}
+
+/**
+ * Make one compound RTCP packet: RR + SDES(CNAME).
+ *
+ * Return the packet size.
+ */
+static unsigned int make_rtcp_rr(struct rtsp_sess *sessp, enum media_type media,
+                                 unsigned long long now, char *buf)
+{
+    struct rtcp_stat *statp = &sessp->rtcp_stat[media];
+    struct rtcp_hdr *hdrp = NULL;
+    unsigned int *word = NULL;
+    unsigned int ext_max = statp->cycles + statp->max_seq;
+    unsigned int expected = ext_max - statp->base_seq + 1;
+    unsigned int expected_intvl = expected - statp->expected_prior;
+    unsigned int received_intvl = statp->received - statp->received_prior;
+    int lost = expected - statp->received;
+    int lost_intvl = expected_intvl - received_intvl;
+    unsigned int fraction = 0;
+    unsigned int dlsr = 0;
+    unsigned int sz = 0;
+    unsigned int cname_len = strlen(RTCP_CNAME);
+
+    statp->expected_prior = expected;
+    statp->received_prior = statp->received;
+    if (expected_intvl && lost_intvl > 0) {
+        fraction = (lost_intvl << 8) / expected_intvl;
+    }
+    lost = lost > 0x7FFFFF ? 0x7FFFFF : (lost < -0x800000 ? -0x800000 : lost);
+    if (statp->last_sr) {
+        dlsr = (now - statp->last_sr) * 65536 / MILLION; /* units of 1/65536 second */
+    }
+
+    /* Receiver report with one report block. */
+    hdrp = (struct rtcp_hdr *)buf;
+    hdrp->v = 2;
+    hdrp->p = 0;
+    hdrp->cnt = 1;
+    hdrp->pt = RTCP_PT_RR;
+    hdrp->len = htons(7);
+    word = (unsigned int *)(hdrp + 1);
+    word[0] = htonl(sessp->ssrc);
+    word[1] = htonl(statp->ssrc);
+    word[2] = htonl((fraction << 24) | (lost & 0xFFFFFF));
+    word[3] = htonl(ext_max);
+    word[4] = htonl(statp->jitter >> 4);
+    word[5] = htonl(statp->lsr);
+    word[6] = htonl(dlsr);
+    sz = sizeof(*hdrp) + 7 * 4;
+
+    /* Source description with CNAME, padded to 32-bit boundary. */
+    hdrp = (struct rtcp_hdr *)(buf + sz);
+    hdrp->v = 2;
+    hdrp->p = 0;
+    hdrp->cnt = 1;
+    hdrp->pt = RTCP_PT_SDES;
+    word = (unsigned int *)(hdrp + 1);
+    word[0] = htonl(sessp->ssrc);
+    buf[sz + 8] = 1;            /* CNAME */
+    buf[sz + 9] = cname_len;
+    memcpy(buf + sz + 10, RTCP_CNAME, cname_len);
+    memset(buf + sz + 10 + cname_len, 0, 4);
+    hdrp->len = htons((4 + 2 + cname_len + 1 + 3) / 4);
+    sz += (ntohs(hdrp->len) + 1) * 4;
+
+    return sz;
+}
+
+/**
+ * Send RTCP RR of each media every RTCP_RR_INTVL seconds.
+ */
+int send_rtcp_rr(struct rtsp_sess *sessp, unsigned long long now)
+{
+    struct send_buf *sendp = NULL;
+    struct intlvd *intlvdp = NULL;
+    unsigned int off = 0;
+    int i = 0;
+
+    if (now >= sessp->last_rtcp_rr &&
+        now - sessp->last_rtcp_rr < RTCP_RR_INTVL * MILLION) {
+        return 0;
+    }
+    sessp->last_rtcp_rr = now;
+
+    for (i = 0; i < 2; i++) {
+        if (!sessp->rtp_rtcp[i].ready || !sessp->rtcp_stat[i].active) {
+            continue;
+        }
+
+        sendp = alloc_send_buf(i == MEDIA_TYPE_VIDEO ? DATA_TYPE_RTCP_V_PKT :
+                               DATA_TYPE_RTCP_A_PKT, RTCP_PKT_SZ);
+        if (!sendp) {
+            return -1;
+        }
+
+        /* RTCP is sent over the RTSP connection in interleaved mode. */
+        off = sessp->intlvd_mode ? sizeof(*intlvdp) : 0;
+        sendp->sz = off + make_rtcp_rr(sessp, i, now, sendp->buf + off);
+        if (sessp->intlvd_mode) {
+            intlvdp = (struct intlvd *)sendp->buf;
+            intlvdp->dollar = '$';
+            intlvdp->chn = i * 2 + 1;
+            intlvdp->sz = htons(sendp->sz - off);
+        }
+        list_add_tail(&sendp->entry, &sessp->send_queue);
+    }
+    return 0;
+}
+
+/**
+ * The server takes RTCP RR as keepalive message. If the server
+ * is sending SR, we know it's running RTCP, and we needn't keepalive
+ * the session by RTSP request as long as we're sending RR.
+ *
+ * Return 1 if RTCP keeps the session alive, 0 if not.
+ */
+int rtcp_keeps_alive(struct rtsp_sess *sessp, unsigned long long now)
+{
+    unsigned long long timeout = (unsigned long long)sessp->sess_timeout * MILLION;
+    int i = 0;
+
+    for (i = 0; i < 2; i++) {
+        if (sessp->rtp_rtcp[i].ready && sessp->rtcp_stat[i].last_sr &&
+            now >= sessp->rtcp_stat[i].last_sr &&
+            now - sessp->rtcp_stat[i].last_sr < timeout) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 int handle_rtcp_pkt(struct rtsp_sess *sessp, enum media_type media,
                     char *data, unsigned int sz)
 {
-    printd(DEBUG "------------------- rtcp pkt --------->\n");
+    struct rtcp_hdr *hdrp = NULL;
+    struct rtcp_stat *statp = &sessp->rtcp_stat[media];
+    unsigned int *word = NULL;
+    unsigned int len = 0;
+
+    /* Walk through the compound packet. */
+    while (sz >= sizeof(*hdrp)) {
+        hdrp = (struct rtcp_hdr *)data;
+        len = (ntohs(hdrp->len) + 1) * 4;
+        if (hdrp->v != 2 || len > sz) {
+            printd(WARNING "Malformed RTCP packet!\n");
+            return -1;
+        }
+
+        if (hdrp->pt == RTCP_PT_SR && len >= sizeof(*hdrp) + 12) {
+            /* SSRC, NTP timestamp(MSW, LSW) */
+            word = (unsigned int *)(hdrp + 1);
+            statp->lsr = (ntohl(word[1]) << 16) | (ntohl(word[2]) >> 16);
+            statp->last_sr = time_now();
+        } else if (hdrp->pt == RTCP_PT_BYE) {
+            printd(INFO "RTCP BYE received.\n");
+        }
+
+        data += len;
+        sz -= len;
+    }
     return 0;
 }
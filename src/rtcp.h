@@ -9,6 +9,41 @@
 #define __RTCP_H__
 
 
+#define RTCP_RR_INTVL   5       /* interval of sending RTCP RR, second(s) */
+#define RTCP_PKT_SZ     128     /* enough for RTCP packets we send */
+
+/* RTCP packet type. */
+enum rtcp_pt {
+    RTCP_PT_SR      = 200,
+    RTCP_PT_RR      = 201,
+    RTCP_PT_SDES    = 202,
+    RTCP_PT_BYE     = 203,
+    RTCP_PT_APP     = 204,
+};
+
+/* Statistics of received RTP packets, used to make RTCP RR. */
+struct rtcp_stat {
+    int active;                 /* received any RTP packet */
+    unsigned int ssrc;          /* SSRC of the sender */
+    unsigned short max_seq;     /* highest sequence number seen */
+    unsigned int cycles;        /* shifted count of sequence number cycles */
+    unsigned int base_seq;      /* first sequence number */
+    unsigned int received;      /* packets received */
+    unsigned int expected_prior;    /* packets expected at last RR */
+    unsigned int received_prior;    /* packets received at last RR */
+    int transit;                /* relative transit time of last packet */
+    unsigned int jitter;        /* estimated jitter, scaled by 16 */
+    unsigned int lsr;           /* middle 32 bits of NTP timestamp in last SR */
+    unsigned long long last_sr; /* time of receiving last SR */
+};
+
+struct rtsp_sess;
+struct rtp_hdr;
+void update_rtcp_stat(struct rtsp_sess *sessp, enum media_type media,
+                      const struct rtp_hdr *hdrp);
+int send_rtcp_rr(struct rtsp_sess *sessp, unsigned long long now);
+int rtcp_keeps_alive(struct rtsp_sess *sessp, unsigned long long now);
+
 int handle_rtcp_pkt(struct rtsp_sess *sessp, enum media_type media,
                     char *data, unsigned int sz);
 
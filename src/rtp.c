@@ -7,69 +7,794 @@
 
 #include "rtsp_cli.h"
 #include "rtp.h"
+#include "rtcp.h"
+#include "g711.h"
+#include "codec.h"
 #include "log.h"
 
 
-int handle_rtp_pkt(struct rtsp_sess *sessp, enum media_type media,
-                   char *data, unsigned int sz)
+static const char start_code[4] = {0, 0, 0, 1}; /* start code of NALU */
+
+#define NALU_BIT(type)      (1ULL << (type))
+#define HEVC_IRAP_MASK      (((NALU_BIT(HEVC_NALU_TYPE_IRAP_MAX) << 1) - 1) & \
+                             ~(NALU_BIT(HEVC_NALU_TYPE_IRAP_MIN) - 1))
+
+
+/**
+ * Get NALU type from the NALU header.
+ */
+static unsigned int get_nalu_type(enum video_codec codec, const char *nalu)
 {
-    struct rtp_hdr *hdrp = NULL;
-    char *pl = NULL;            /* RTP plyload */
-    char nalu_pt = 0;           /* payload type */
-    char start_code[4] = {0, 0, 0, 1}; /* start code of NALU */
-    struct frm_info *frmp = &sessp->frm_info;
-    char nalu_hdr = 0;
-    enum frm_type frm_type;
-    char *frm_buf = frmp->frm_buf + sessp->chn_info.frm_hdr_sz;
+    if (codec == VIDEO_CODEC_H265) {
+        return (nalu[0] >> 1) & 0x3F;
+    }
+    return nalu[0] & 0x1F;
+}
 
-    hdrp = (struct rtp_hdr *)data;
-    pl = data + sizeof(*hdrp);
-
-    switch (hdrp->pt) {
-    case RTP_PT_H264:
-        nalu_pt = pl[0] & 0x1F; /* first byte in payload & 0x1F */
-        switch (nalu_pt) {
-        case 1 ... 23:          /* single NALU Packet. */
-            nalu_hdr = pl[0];
-            frm_type = ((nalu_hdr & 0x1F) == 0x01) ? FRM_TYPE_PF : FRM_TYPE_IF;
-            printd("start code--------[cseq = %d]------>sz = %d\n", ntohs(hdrp->seq), sz);
-            memcpy(frm_buf + frmp->frm_sz, &start_code, sizeof(start_code));
-            frmp->frm_sz += sizeof(start_code);
-            memcpy(frm_buf + frmp->frm_sz, pl, sz - sizeof(*hdrp));
-            frmp->frm_sz += sz - sizeof(*hdrp);
-            break;
-        case NALU_PT_FU_A:
-            nalu_hdr = (pl[0] & 0xE0) | (pl[1] & 0x1F);
-            frm_type = ((nalu_hdr & 0x1F) == 0x01) ? FRM_TYPE_PF : FRM_TYPE_IF;
-            if (pl[1] & 0x80) { /* first segment in NALU */
-                printd("start code--------[cseq = %d]------>sz = %d\n", ntohs(hdrp->seq), sz);
-                memcpy(frm_buf + frmp->frm_sz, &start_code, sizeof(start_code));
-                frmp->frm_sz += sizeof(start_code);
-                frm_buf[frmp->frm_sz] = nalu_hdr;
-                frmp->frm_sz += 1;
+/**
+ * Decode base64 NALUs separated by ',', and append them to psp.
+ */
+static int decode_param_sets(struct param_sets *psp, const char *ptr)
+{
+    const char *end = NULL;
+    int sz = 0;
+
+    while (ptr && *ptr && psp->num < MAX_PARAM_SET_NUM) {
+        end = strchr(ptr, ',');
+        if (!end) {
+            end = ptr + strlen(ptr);
+        }
+        sz = base64_decode(ptr, end - ptr, psp->buf + psp->sz,
+                           sizeof(psp->buf) - psp->sz);
+        if (sz < 0) {
+            return -1;
+        }
+        if (sz > 0) {
+            psp->nalu[psp->num].off = psp->sz;
+            psp->nalu[psp->num].sz = sz;
+            psp->num++;
+            psp->sz += sz;
+        }
+        ptr = *end ? end + 1 : end;
+    }
+    return 0;
+}
+
+/**
+ * Decode the parameter sets in `a=fmtp' of video,
+ * so that we needn't do it for each key frame.
+ */
+static int load_param_sets(struct rtsp_sess *sessp)
+{
+    struct param_sets *psp = &sessp->param_sets;
+    struct sdp_m *m = NULL;
+    int ret = 0;
+
+    psp->num = 0;
+    psp->sz = 0;
+
+    if (!sessp->sdp_info) {
+        return 0;
+    }
+    m = &sessp->sdp_info->sdp_m[MEDIA_TYPE_VIDEO];
+    if (sessp->video_codec == VIDEO_CODEC_H265) {
+        ret |= decode_param_sets(psp, m->fmtp.sprop_vps);
+        ret |= decode_param_sets(psp, m->fmtp.sprop_sps);
+        ret |= decode_param_sets(psp, m->fmtp.sprop_pps);
+    } else {
+        ret = decode_param_sets(psp, m->fmtp.sprop_parameter_sets);
+    }
+
+    if (ret < 0) {
+        printd(WARNING "Illegal parameter sets in SDP!\n");
+        psp->num = 0;
+        psp->sz = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Build the payload type table from static payload types and
+ * `a=rtpmap' of SDP, so each RTP packet is dispatched by one lookup.
+ * Payload types are scoped by m-line, audio and video may use the same
+ * dynamic one, so the table is kept per media.
+ */
+int load_pt_map(struct rtsp_sess *sessp)
+{
+    const struct codec *codec = NULL;
+    struct sdp_m *m = NULL;
+    unsigned int pt = 0;
+    int i = 0;
+
+    memset(sessp->pt_map, 0, sizeof(sessp->pt_map));
+    sessp->video_codec = VIDEO_CODEC_H264;
+
+    for (pt = 0; pt < RTP_PT_NUM; pt++) {
+        codec = find_codec_by_pt(pt);
+        if (codec) {
+            sessp->pt_map[codec->media][pt].depack = codec->depack;
+            sessp->pt_map[codec->media][pt].clk_rate = codec->clk_rate;
+        }
+    }
+
+    for (i = 0; sessp->sdp_info && i < 2; i++) {
+        m = &sessp->sdp_info->sdp_m[i];
+        if (!m->enable) {
+            continue;
+        }
+        if (m->rtpmap.enc_name) {
+            pt = m->rtpmap.pt;
+            codec = find_codec_by_name(m->rtpmap.enc_name);
+        } else {
+            pt = m->pt;
+            codec = find_codec_by_pt(pt);
+            if (!codec && i == MEDIA_TYPE_VIDEO) {
+                codec = find_codec_by_name("H264");
             }
-            memcpy(frm_buf + frmp->frm_sz, pl + 2, sz - sizeof(*hdrp) - 2);
-            frmp->frm_sz += sz - sizeof(*hdrp) - 2;
-            break;
+        }
+        if (!codec || codec->media != i || pt >= RTP_PT_NUM) {
+            printd(WARNING "Unsupported codec[%s] of payload type[%d]!\n",
+                   m->rtpmap.enc_name ? m->rtpmap.enc_name : "", pt);
+            continue;
+        }
+        sessp->pt_map[i][pt].depack = codec->depack;
+        sessp->pt_map[i][pt].clk_rate = m->rtpmap.clk_rate ? m->rtpmap.clk_rate : codec->clk_rate;
+        if (codec->media == MEDIA_TYPE_VIDEO) {
+            sessp->video_codec = codec->video_codec;
+        }
+    }
+
+    /* Without SDP, keep the old behavior. */
+    if (!sessp->sdp_info) {
+        sessp->pt_map[MEDIA_TYPE_VIDEO][RTP_PT_H264].depack = depack_h264;
+        sessp->pt_map[MEDIA_TYPE_VIDEO][RTP_PT_H264].clk_rate = VIDEO_CLK_RATE;
+    }
+
+    if (load_param_sets(sessp) < 0) {
+        sessp->codec_cfg_sz = -1;
+        return -1;
+    }
+    sessp->codec_cfg_sz = build_codec_cfg(sessp->video_codec, &sessp->param_sets,
+                                          sessp->codec_cfg, sizeof(sessp->codec_cfg));
+    return 0;
+}
+
+int init_frm_ctx(struct frm_ctx *ctx, unsigned int buf_sz)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->frm_info.frm_buf = mallocz(buf_sz);
+    if (!ctx->frm_info.frm_buf) {
+        printd(EMERG "Allocate memory for storing frame failed!\n");
+        return -1;
+    }
+    ctx->buf_sz = buf_sz;
+    return 0;
+}
+
+void deinit_frm_ctx(struct frm_ctx *ctx)
+{
+    freez(ctx->frm_info.frm_buf);
+    ctx->buf_sz = 0;
+    return;
+}
+
+/**
+ * Append data to the frame being assembled.
+ * If the frame buffer overflows, the frame will be dropped.
+ */
+static void append_frm(struct rtsp_sess *sessp, struct frm_ctx *ctx,
+                       const char *data, unsigned int sz)
+{
+    struct frm_info *frmp = &ctx->frm_info;
+    char *frm_buf = frmp->frm_buf + sessp->chn_info.frm_hdr_sz;
+
+    if (ctx->frm_drop) {
+        return;
+    }
+    if (sessp->chn_info.frm_hdr_sz + frmp->frm_sz + sz > ctx->buf_sz) {
+        printd(WARNING "Frame is too large, drop it!\n");
+        ctx->frm_drop = 1;
+        return;
+    }
+    memcpy(frm_buf + frmp->frm_sz, data, sz);
+    frmp->frm_sz += sz;
+    return;
+}
+
+/**
+ * Decode G.711 samples into the frame being assembled.
+ * If the frame buffer overflows, the frame will be dropped.
+ */
+static void append_pcm16(struct rtsp_sess *sessp, struct frm_ctx *ctx,
+                         enum rtp_pt pt, const char *data, unsigned int sz)
+{
+    struct frm_info *frmp = &ctx->frm_info;
+    char *frm_buf = frmp->frm_buf + sessp->chn_info.frm_hdr_sz;
+
+    if (ctx->frm_drop) {
+        return;
+    }
+    if (sessp->chn_info.frm_hdr_sz + frmp->frm_sz + 2 * sz > ctx->buf_sz) {
+        printd(WARNING "Frame is too large, drop it!\n");
+        ctx->frm_drop = 1;
+        return;
+    }
+    if (pt == RTP_PT_PCMA) {
+        alaw_to_pcm16((const unsigned char *)data, frm_buf + frmp->frm_sz, sz);
+    } else {
+        ulaw_to_pcm16((const unsigned char *)data, frm_buf + frmp->frm_sz, sz);
+    }
+    frmp->frm_sz += 2 * sz;
+    return;
+}
+
+/**
+ * The NALU being assembled ends where the frame ends now.
+ * Fill in its length prefix in AVCC mode.
+ */
+static void end_nalu(struct rtsp_sess *sessp, struct frm_ctx *ctx)
+{
+    struct frm_info *frmp = &ctx->frm_info;
+    unsigned char *len = NULL;
+    unsigned int sz = 0;
+
+    if (!ctx->nalu_num || ctx->frm_drop) {
+        return;
+    }
+    sz = frmp->frm_sz - ctx->nalu_off;
+    if (ctx->nalu_num <= MAX_NALU_NUM) {
+        ctx->nalu[ctx->nalu_num - 1].sz = sz;
+    }
+    if (sessp->chn_info.flags & CHN_FLAG_AVCC) {
+        len = (unsigned char *)frmp->frm_buf + sessp->chn_info.frm_hdr_sz +
+            ctx->nalu_off - NALU_LEN_SZ;
+        len[0] = (sz >> 24) & 0xFF;
+        len[1] = (sz >> 16) & 0xFF;
+        len[2] = (sz >> 8) & 0xFF;
+        len[3] = sz & 0xFF;
+    }
+    return;
+}
+
+/**
+ * In pull mode with CHN_FLAG_PACING, a frame the playout thread
+ * can't take is dropped, and video is dropped till the next key
+ * frame, so what's pulled stays decodable.
+ */
+static void shed_paced_frm(struct rtsp_sess *sessp, struct frm_ctx *ctx)
+{
+    count_drop_stat(sessp->deliver_ring, &ctx->frm_info);
+    if (ctx->frm_info.frm_type != FRM_TYPE_AF) {
+        ctx->pace_shed = 1;
+    }
+    return;
+}
+
+static int drop_paced_frm(struct rtsp_sess *sessp, struct frm_ctx *ctx)
+{
+    const struct frm_info *frmp = &ctx->frm_info;
+
+    if (!ctx->pace_shed) {
+        return 0;
+    }
+    if (frmp->frm_type == FRM_TYPE_IF && (frmp->flags & FRM_FLAG_START)) {
+        ctx->pace_shed = 0;
+        return 0;
+    }
+    count_drop_stat(sessp->deliver_ring, frmp);
+    return 1;
+}
+
+/**
+ * Pass the frame on to user, or to the playout timer.
+ */
+static void pass_frm(struct rtsp_sess *sessp, struct frm_ctx *ctx)
+{
+    struct frm_copy *cp = NULL;
+
+    if (sessp->shm_ring) {
+        publish_shm_frm(sessp->shm_ring, &ctx->frm_info, sessp->chn_info.frm_hdr_sz);
+    }
+    if (sessp->chn_info.flags & CHN_FLAG_PACING) {
+        if (drop_paced_frm(sessp, ctx)) {
+            return;
+        }
+        if (!put_playout_frm(sessp, &ctx->playout_clk, &ctx->frm_info, ctx->clk_rate)) {
+            return;
+        }
+        if (sessp->deliver_ring) {
+            /* The playout thread is the only producer of the ring. */
+            shed_paced_frm(sessp, ctx);
+            return;
+        }
+    }
+    if (sessp->deliver_ring) {
+        push_deliver_ring(sessp, &ctx->frm_info);
+        return;
+    }
+    if (sessp->frm_batch && rtsp_cli.store_frms) {
+        /* The buffer is reused by next frame, flushed by single_step(). */
+        if ((cp = copy_frm(sessp, &ctx->frm_info)) != NULL) {
+            add_frm_batch(sessp->frm_batch, cp);
+            return;
+        }
+    }
+    store_sess_frm(sessp, &ctx->frm_info);
+    return;
+}
+
+/**
+ * Pass what's assembled on to user, the NALU state of frame is kept.
+ */
+static void deliver_frm(struct rtsp_sess *sessp, struct frm_ctx *ctx,
+                        enum frm_type frm_type, unsigned int flags)
+{
+    struct frm_info *frmp = &ctx->frm_info;
+
+    frmp->frm_type = frm_type;
+    frmp->flags = flags | (ctx->nonref ? FRM_FLAG_NONREF : 0);
+    end_nalu(sessp, ctx);
+    frmp->nalu = (ctx->nalu_num && ctx->nalu_num <= MAX_NALU_NUM) ? ctx->nalu : NULL;
+    frmp->nalu_num = frmp->nalu ? ctx->nalu_num : 0;
+    frmp->ts = ctx->frm_ts;
+    /* The end of a frame is told even if nothing is left of it. */
+    if (!ctx->frm_drop && (frmp->frm_sz || flags == FRM_FLAG_END)) {
+        pass_frm(sessp, ctx);
+    }
+    frmp->frm_sz = 0;
+    ctx->nalu_num = 0;
+    return;
+}
+
+/**
+ * Pass the frame, or the rest of it in slice mode, on to user,
+ * and start a new one.
+ */
+static void store_frm_ctx(struct rtsp_sess *sessp, struct frm_ctx *ctx,
+                          enum frm_type frm_type)
+{
+    deliver_frm(sessp, ctx, frm_type,
+                (ctx->frm_started ? 0 : FRM_FLAG_START) | FRM_FLAG_END);
+    ctx->frm_drop = 0;
+    ctx->frm_started = 0;
+    ctx->nalu_seen = 0;
+    ctx->vcl_seen = 0;
+    ctx->nonref = 0;
+    return;
+}
+
+/**
+ * Put a start code, or room for the length prefix in AVCC mode,
+ * and index the NALU after it.
+ */
+static void put_start_code(struct rtsp_sess *sessp, struct frm_ctx *ctx,
+                           unsigned int type)
+{
+    static const char len_prefix[NALU_LEN_SZ] = {0};
+
+    end_nalu(sessp, ctx);
+    if (sessp->chn_info.flags & CHN_FLAG_AVCC) {
+        append_frm(sessp, ctx, len_prefix, sizeof(len_prefix));
+    } else {
+        append_frm(sessp, ctx, start_code, sizeof(start_code));
+    }
+    ctx->nalu_off = ctx->frm_info.frm_sz;
+    if (ctx->nalu_num < MAX_NALU_NUM) {
+        ctx->nalu[ctx->nalu_num].off = ctx->frm_info.frm_sz;
+        ctx->nalu[ctx->nalu_num].sz = 0;
+        ctx->nalu[ctx->nalu_num].type = type;
+    }
+    ctx->nalu_num++;
+    ctx->nalu_seen |= NALU_BIT(type);
+    return;
+}
+
+/**
+ * Whether the VCL NALU belongs to a picture not used for reference.
+ */
+static int nonref_nalu(struct rtsp_sess *sessp, const char *nalu_hdr)
+{
+    unsigned int type = get_nalu_type(sessp->video_codec, nalu_hdr);
+
+    if (sessp->video_codec == VIDEO_CODEC_H265) {
+        /* sub-layer non-reference pictures: TRAIL_N, TSA_N, ... RSV_VCL_N14 */
+        return type < HEVC_NALU_TYPE_IRAP_MIN && !(type & 0x01);
+    }
+    return !(nalu_hdr[0] & 0x60);   /* nal_ref_idc == 0 */
+}
+
+/**
+ * Decide whether to drop the frame by the decimation mode of channel,
+ * called with the header of the first VCL NALU in the frame.
+ */
+static int decimate_frm(struct rtsp_sess *sessp, const char *nalu_hdr, int key)
+{
+    struct frm_ctx *ctx = &sessp->frm_ctx[MEDIA_TYPE_VIDEO];
+    enum decim_mode mode = __atomic_load_n(&sessp->chn_info.decim_mode, __ATOMIC_ACQUIRE);
+    unsigned int gop = __atomic_load_n(&sessp->chn_info.decim_gop, __ATOMIC_RELAXED);
+
+    switch (mode) {
+    case DECIM_KEY_ONLY:
+        return !key;
+    case DECIM_REF_ONLY:
+        return ctx->nonref;
+    case DECIM_GOP:
+        if (key) {
+            ctx->gop_keep = !gop || !(ctx->gop_cnt++ % gop);
+        }
+        return !ctx->gop_keep;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Get frame type from the NALUs seen in the frame.
+ */
+static enum frm_type get_video_frm_type(struct rtsp_sess *sessp)
+{
+    struct frm_ctx *ctx = &sessp->frm_ctx[MEDIA_TYPE_VIDEO];
+
+    if (sessp->video_codec == VIDEO_CODEC_H265) {
+        return (ctx->nalu_seen & HEVC_IRAP_MASK) ? FRM_TYPE_IF : FRM_TYPE_PF;
+    }
+    return (ctx->nalu_seen & NALU_BIT(NALU_TYPE_IDR)) ? FRM_TYPE_IF : FRM_TYPE_PF;
+}
+
+/**
+ * Whether the NALU starts a new access unit, used when
+ * the marker bit can't be trusted. body is what follows
+ * the NALU header, sz is 0 if it's unknown.
+ */
+static int new_access_unit(struct rtsp_sess *sessp, unsigned int type,
+                           const char *body, unsigned int sz)
+{
+    struct frm_ctx *ctx = &sessp->frm_ctx[MEDIA_TYPE_VIDEO];
+
+    if (!ctx->vcl_seen) {
+        return 0;
+    }
+    if (sessp->video_codec == VIDEO_CODEC_H265) {
+        switch (type) {
+        case HEVC_NALU_TYPE_VPS:
+        case HEVC_NALU_TYPE_SPS:
+        case HEVC_NALU_TYPE_PPS:
+        case HEVC_NALU_TYPE_AUD:
+        case HEVC_NALU_TYPE_PREFIX_SEI:
+            return 1;
+        case 0 ... HEVC_NALU_TYPE_IRAP_MAX:     /* first_slice_segment_in_pic_flag */
+            return sz && (body[0] & 0x80);
         default:
-            printd("Unsupported or undefined NALU payload type[%d]\n", nalu_pt);
-            break;
+            return 0;
         }
+    }
+    switch (type) {
+    case NALU_TYPE_SEI:
+    case NALU_TYPE_SPS:
+    case NALU_TYPE_PPS:
+    case NALU_TYPE_AUD:
+        return 1;
+    case NALU_TYPE_SLICE ... NALU_TYPE_IDR:     /* first_mb_in_slice == 0 */
+        return sz && (body[0] & 0x80);
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Start a new NALU in the frame, the NALU header
+ * is appended by the caller. body is what follows the NALU
+ * header in this packet, sz is its size.
+ *
+ * A key frame without parameter sets ahead in the frame
+ * can't be decoded, so put the ones from SDP before it.
+ */
+static void begin_nalu(struct rtsp_sess *sessp, const char *nalu_hdr,
+                       const char *body, unsigned int sz)
+{
+    struct frm_ctx *ctx = &sessp->frm_ctx[MEDIA_TYPE_VIDEO];
+    struct param_sets *psp = &sessp->param_sets;
+    unsigned int type = get_nalu_type(sessp->video_codec, nalu_hdr);
+    unsigned long long ps_mask = 0;
+    int key = 0;
+    int vcl = 0;
+    unsigned int i = 0;
+
+    if (sessp->video_codec == VIDEO_CODEC_H265) {
+        ps_mask = NALU_BIT(HEVC_NALU_TYPE_VPS) | NALU_BIT(HEVC_NALU_TYPE_SPS) |
+            NALU_BIT(HEVC_NALU_TYPE_PPS);
+        key = !!(NALU_BIT(type) & HEVC_IRAP_MASK);
+        vcl = (type < HEVC_NALU_TYPE_VPS);
+    } else {
+        ps_mask = NALU_BIT(NALU_TYPE_SPS) | NALU_BIT(NALU_TYPE_PPS);
+        key = (type == NALU_TYPE_IDR);
+        vcl = (type >= NALU_TYPE_SLICE && type <= NALU_TYPE_IDR);
+    }
+
+    if ((sessp->chn_info.flags & CHN_FLAG_AU_BOUNDARY) &&
+        new_access_unit(sessp, type, body, sz)) {
+        store_frm_ctx(sessp, ctx, get_video_frm_type(sessp));
+    }
+
+    /* Drop before copying any slice data. */
+    if (vcl && !ctx->vcl_seen) {
+        ctx->vcl_seen = 1;
+        ctx->nonref = nonref_nalu(sessp, nalu_hdr);
+        if (decimate_frm(sessp, nalu_hdr, key)) {
+            ctx->frm_drop = 1;
+        }
+    }
+    if (ctx->frm_drop) {
+        return;
+    }
+
+    if (key && (ctx->nalu_seen & ps_mask) != ps_mask) {
+        for (i = 0; i < psp->num; i++) {
+            put_start_code(sessp, ctx,
+                           get_nalu_type(sessp->video_codec, psp->buf + psp->nalu[i].off));
+            append_frm(sessp, ctx, psp->buf + psp->nalu[i].off, psp->nalu[i].sz);
+        }
+    }
+
+    put_start_code(sessp, ctx, type);
+    return;
+}
+
+/**
+ * Unpack NALUs in an aggregation packet, pl points to
+ * the first aggregation unit: 16 bits NALU size, then the NALU.
+ */
+static int unpack_aggr_units(struct rtsp_sess *sessp, char *pl, unsigned int sz)
+{
+    struct frm_ctx *ctx = &sessp->frm_ctx[MEDIA_TYPE_VIDEO];
+    unsigned int nalu_sz = 0;
+    unsigned int hdr_sz = 0;
+    char *nalu = NULL;
+
+    while (sz > 2) {
+        nalu_sz = ((unsigned char)pl[0] << 8) | (unsigned char)pl[1];
+        if (!nalu_sz || nalu_sz > sz - 2) {
+            printd(WARNING "Illegal NALU size in aggregation packet!\n");
+            return -1;
+        }
+        nalu = pl + 2;
+        hdr_sz = (sessp->video_codec == VIDEO_CODEC_H265) ? 2 : 1;
+        begin_nalu(sessp, nalu, nalu + hdr_sz, (nalu_sz > hdr_sz) ? nalu_sz - hdr_sz : 0);
+        append_frm(sessp, ctx, nalu, nalu_sz);
+        pl += 2 + nalu_sz;
+        sz -= 2 + nalu_sz;
+    }
+    ctx->nalu_done = 1;
+    return 0;
+}
+
+/**
+ * H.264 payload, RFC 6184.
+ */
+static int handle_h264_pl(struct rtsp_sess *sessp, char *pl, unsigned int sz)
+{
+    struct frm_ctx *ctx = &sessp->frm_ctx[MEDIA_TYPE_VIDEO];
+    char nalu_pt = 0;           /* payload type */
+    char nalu_hdr = 0;
+    unsigned int fu_hdr_sz = 0;
+
+    if (sz < 1) {
+        return -1;
+    }
+
+    nalu_pt = pl[0] & 0x1F; /* first byte in payload & 0x1F */
+    switch (nalu_pt) {
+    case 1 ... 23:          /* single NALU Packet. */
+        begin_nalu(sessp, pl, pl + 1, sz - 1);
+        append_frm(sessp, ctx, pl, sz);
+        ctx->nalu_done = 1;
         break;
-    case RTP_PT_PCMA:
-    case RTP_PT_PCMU:
-        frm_type = FRM_TYPE_AF;
+    case NALU_PT_STAP_A:        /* 8 bits header */
+        return unpack_aggr_units(sessp, pl + 1, sz - 1);
+    case NALU_PT_STAP_B:
+    case NALU_PT_MTAP16:
+    case NALU_PT_MTAP24:
+        /*
+         * Interleaved mode only. Their NALUs come in decoding order(DON),
+         * and those of MTAP may belong to other pictures(TS offset),
+         * neither is supported, so the frame can't be completed.
+         */
+        printd(WARNING "Interleaved aggregation packet[%d] unsupported, drop it!\n", nalu_pt);
+        ctx->frm_drop = 1;
+        break;
+    case NALU_PT_FU_A:
+    case NALU_PT_FU_B:          /* FU-B has 16 bits DON after FU header */
+        fu_hdr_sz = (nalu_pt == NALU_PT_FU_B) ? 4 : 2;
+        if (sz < fu_hdr_sz) {
+            return -1;
+        }
+        nalu_hdr = (pl[0] & 0xE0) | (pl[1] & 0x1F);
+        if (pl[1] & 0x80) { /* first segment in NALU */
+            begin_nalu(sessp, &nalu_hdr, pl + fu_hdr_sz, sz - fu_hdr_sz);
+            append_frm(sessp, ctx, &nalu_hdr, 1);
+        }
+        append_frm(sessp, ctx, pl + fu_hdr_sz, sz - fu_hdr_sz);
+        ctx->nalu_done = !!(pl[1] & 0x40);  /* last segment in NALU */
+        break;
+    default:
+        printd("Unsupported or undefined NALU payload type[%d]\n", nalu_pt);
+        break;
+    }
+    return 0;
+}
+
+/**
+ * H.265 payload, RFC 7798.
+ * DONL is absent since we don't support sprop-max-don-diff > 0.
+ */
+static int handle_h265_pl(struct rtsp_sess *sessp, char *pl, unsigned int sz)
+{
+    struct frm_ctx *ctx = &sessp->frm_ctx[MEDIA_TYPE_VIDEO];
+    unsigned int nalu_pt = 0;   /* payload type */
+    char nalu_hdr[2];
+
+    if (sz < 2) {
+        return -1;
+    }
+
+    nalu_pt = get_nalu_type(VIDEO_CODEC_H265, pl);
+    switch (nalu_pt) {
+    case 0 ... 47:              /* single NALU packet */
+        begin_nalu(sessp, pl, pl + 2, sz - 2);
+        append_frm(sessp, ctx, pl, sz);
+        ctx->nalu_done = 1;
+        break;
+    case HEVC_NALU_PT_AP:       /* aggregation packet */
+        return unpack_aggr_units(sessp, pl + 2, sz - 2);
+    case HEVC_NALU_PT_FU:       /* fragmentation unit */
+        if (sz < 3) {
+            return -1;
+        }
+        if (pl[2] & 0x80) {     /* first segment in NALU */
+            nalu_hdr[0] = (pl[0] & 0x81) | ((pl[2] & 0x3F) << 1);
+            nalu_hdr[1] = pl[1];
+            begin_nalu(sessp, nalu_hdr, pl + 3, sz - 3);
+            append_frm(sessp, ctx, nalu_hdr, sizeof(nalu_hdr));
+        }
+        append_frm(sessp, ctx, pl + 3, sz - 3);
+        ctx->nalu_done = !!(pl[2] & 0x40);  /* last segment in NALU */
         break;
     default:
-        printd("Unsupported or undefined RTP payload type[%d]\n", nalu_pt);
+        printd("Unsupported or undefined NALU payload type[%d]\n", nalu_pt);
         break;
     }
+    return 0;
+}
+
+/**
+ * G.711 payload, one byte per sample.
+ * Decoded to PCM16 if CHN_FLAG_PCM16 is set.
+ *
+ * Continuous packets are batched into one frame until
+ * chn_info.aud_intvl is covered, or the buffer is full.
+ */
+int depack_g711(struct rtsp_sess *sessp, struct rtp_hdr *hdrp,
+                char *pl, unsigned int sz)
+{
+    struct frm_ctx *ctx = &sessp->frm_ctx[MEDIA_TYPE_AUDIO];
+    struct frm_info *frmp = &ctx->frm_info;
+    unsigned int ts = ntohl(hdrp->ts);
+    unsigned int clk_rate = 0;
+    unsigned int out_sz = sz;
+
+    /* Gap or reordering, deliver what we have first. */
+    if (frmp->frm_sz && ts != ctx->next_ts) {
+        store_frm_ctx(sessp, ctx, FRM_TYPE_AF);
+    }
 
-    if (hdrp->m) {              /* last nalu of a frame */
-        frmp->frm_type = frm_type;
-        rtsp_cli.store_frm(&sessp->chn_info, &sessp->frm_info);
-        frmp->frm_sz = 0;
+    if (!frmp->frm_sz) {
+        clk_rate = sessp->pt_map[MEDIA_TYPE_AUDIO][hdrp->pt].clk_rate;
+        ctx->frm_ts = ts;
+        ctx->clk_rate = clk_rate;
+        ctx->ts_left = (unsigned long long)sessp->chn_info.aud_intvl * clk_rate / THOUSAND;
     }
 
+    if (sessp->chn_info.flags & CHN_FLAG_PCM16) {
+        append_pcm16(sessp, ctx, hdrp->pt, pl, sz);
+        out_sz = 2 * sz;
+    } else {
+        append_frm(sessp, ctx, pl, sz);
+    }
+    ctx->next_ts = ts + sz;
+    ctx->ts_left = (ctx->ts_left > sz) ? ctx->ts_left - sz : 0;
+
+    /* Window covered, or no room for another packet like this one. */
+    if (!ctx->ts_left ||
+        sessp->chn_info.frm_hdr_sz + frmp->frm_sz + out_sz > ctx->buf_sz) {
+        store_frm_ctx(sessp, ctx, FRM_TYPE_AF);
+    }
     return 0;
 }
+
+/**
+ * The marker bit is set on the last packet of a video frame.
+ * In slice mode, NALUs completed by this packet are delivered
+ * without waiting for the marker bit.
+ */
+static void end_video_frm(struct rtsp_sess *sessp, struct rtp_hdr *hdrp)
+{
+    struct frm_ctx *ctx = &sessp->frm_ctx[MEDIA_TYPE_VIDEO];
+
+    if (hdrp->m) {
+        store_frm_ctx(sessp, ctx, get_video_frm_type(sessp));
+    } else if ((sessp->chn_info.flags & CHN_FLAG_SLICE) &&
+               ctx->nalu_done && ctx->vcl_seen) {
+        /*
+         * Deliver completed NALUs at once, NALUs ahead of
+         * the first slice go with it, so frm_type is known.
+         */
+        deliver_frm(sessp, ctx, get_video_frm_type(sessp),
+                    ctx->frm_started ? 0 : FRM_FLAG_START);
+        ctx->frm_started = 1;
+    }
+    return;
+}
+
+/**
+ * Packets of a video frame share one timestamp, keep it for the frame.
+ * With CHN_FLAG_AU_BOUNDARY, a new one means the last frame has ended.
+ */
+static void begin_video_pkt(struct rtsp_sess *sessp, struct rtp_hdr *hdrp)
+{
+    struct frm_ctx *ctx = &sessp->frm_ctx[MEDIA_TYPE_VIDEO];
+    unsigned int ts = ntohl(hdrp->ts);
+
+    if ((sessp->chn_info.flags & CHN_FLAG_AU_BOUNDARY) &&
+        (ctx->nalu_seen || ctx->vcl_seen) && ts != ctx->frm_ts) {
+        store_frm_ctx(sessp, ctx, get_video_frm_type(sessp));
+    }
+    ctx->frm_ts = ts;
+    ctx->clk_rate = sessp->pt_map[MEDIA_TYPE_VIDEO][hdrp->pt].clk_rate;
+    return;
+}
+
+int depack_h264(struct rtsp_sess *sessp, struct rtp_hdr *hdrp,
+                char *pl, unsigned int sz)
+{
+    int ret = 0;
+
+    begin_video_pkt(sessp, hdrp);
+    ret = handle_h264_pl(sessp, pl, sz);
+
+    end_video_frm(sessp, hdrp);
+    return ret;
+}
+
+int depack_h265(struct rtsp_sess *sessp, struct rtp_hdr *hdrp,
+                char *pl, unsigned int sz)
+{
+    int ret = 0;
+
+    begin_video_pkt(sessp, hdrp);
+    ret = handle_h265_pl(sessp, pl, sz);
+
+    end_video_frm(sessp, hdrp);
+    return ret;
+}
+
+int handle_rtp_pkt(struct rtsp_sess *sessp, enum media_type media,
+                   char *data, unsigned int sz)
+{
+    struct rtp_hdr *hdrp = NULL;
+    struct pt_map *mapp = NULL;
+
+    if (sz < sizeof(*hdrp)) {
+        return -1;
+    }
+    hdrp = (struct rtp_hdr *)data;
+
+    update_rtcp_stat(sessp, media, hdrp);
+
+    mapp = &sessp->pt_map[media][hdrp->pt];
+    if (!mapp->depack) {
+        printd("Unsupported or undefined RTP payload type[%d]\n", hdrp->pt);
+        return -1;
+    }
+    return mapp->depack(sessp, hdrp, data + sizeof(*hdrp), sz - sizeof(*hdrp));
+}
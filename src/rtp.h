@@ -11,17 +11,57 @@
 
 /* NALU payload type. */
 enum {
+    NALU_PT_STAP_A = 24,
+    NALU_PT_STAP_B = 25,
+    NALU_PT_MTAP16 = 26,
+    NALU_PT_MTAP24 = 27,
     NALU_PT_FU_A = 28,
     NALU_PT_FU_B = 29,
 };
 
+/* NALU payload type of H.265, RFC 7798. */
+enum {
+    HEVC_NALU_PT_AP   = 48,
+    HEVC_NALU_PT_FU   = 49,
+    HEVC_NALU_PT_PACI = 50,
+};
+
+/* NALU type of H.264. */
+enum {
+    NALU_TYPE_SLICE = 1,
+    NALU_TYPE_IDR   = 5,
+    NALU_TYPE_SEI   = 6,
+    NALU_TYPE_SPS   = 7,
+    NALU_TYPE_PPS   = 8,
+    NALU_TYPE_AUD   = 9,
+};
+
+/* NALU type of H.265. */
+enum {
+    HEVC_NALU_TYPE_IRAP_MIN = 16,   /* BLA_W_LP */
+    HEVC_NALU_TYPE_IRAP_MAX = 23,   /* RSV_IRAP_VCL23 */
+    HEVC_NALU_TYPE_VPS      = 32,
+    HEVC_NALU_TYPE_SPS      = 33,
+    HEVC_NALU_TYPE_PPS      = 34,
+    HEVC_NALU_TYPE_AUD      = 35,
+    HEVC_NALU_TYPE_PREFIX_SEI = 39,
+};
+
+/* video codec */
+enum video_codec {
+    VIDEO_CODEC_H264,
+    VIDEO_CODEC_H265,
+};
+
 /* RTP payload type. */
 enum rtp_pt {
-    RTP_PT_H264 = 96,
+    RTP_PT_H264 = 96,           /* used if a=rtpmap of video is absent */
     RTP_PT_PCMU = 0,
     RTP_PT_PCMA = 8,
 };
 
+#define RTP_PT_NUM          128
+
 /* media type */
 enum media_type {
     MEDIA_TYPE_VIDEO,
@@ -29,7 +69,47 @@ enum media_type {
 };
 
 
+#define VIDEO_CLK_RATE      90000   /* clock rate of H.264 & H.265 */
+#define G711_CLK_RATE       8000    /* clock rate of PCMA & PCMU */
+
+#define MAX_PARAM_SET_NUM   8       /* max parameter sets in SDP */
+#define MAX_PARAM_SETS_SZ   1024    /* max size of all decoded parameter sets */
+
+/*
+ * Parameter sets from `sprop-parameter-sets' (H.264) or
+ * `sprop-vps/sps/pps' (H.265) of SDP, decoded once per session.
+ */
+struct param_sets {
+    unsigned int num;           /* number of NALUs */
+    unsigned int sz;            /* bytes used in buf */
+    struct {
+        unsigned int off;       /* offset in buf */
+        unsigned int sz;        /* size of NALU */
+    } nalu[MAX_PARAM_SET_NUM];
+    char buf[MAX_PARAM_SETS_SZ];
+};
+
 struct rtsp_sess;
+struct rtp_hdr;
+struct frm_ctx;
+
+/* Depacketizer, called with the payload of each RTP packet. */
+typedef int (*depack_t)(struct rtsp_sess *sessp, struct rtp_hdr *hdrp,
+                        char *pl, unsigned int sz);
+
+/* entry of payload type table, indexed by media & payload type */
+struct pt_map {
+    depack_t depack;            /* NULL if not negotiated */
+    unsigned int clk_rate;
+};
+
+int depack_h264(struct rtsp_sess *sessp, struct rtp_hdr *hdrp, char *pl, unsigned int sz);
+int depack_h265(struct rtsp_sess *sessp, struct rtp_hdr *hdrp, char *pl, unsigned int sz);
+int depack_g711(struct rtsp_sess *sessp, struct rtp_hdr *hdrp, char *pl, unsigned int sz);
+
+int init_frm_ctx(struct frm_ctx *ctx, unsigned int buf_sz);
+void deinit_frm_ctx(struct frm_ctx *ctx);
+int load_pt_map(struct rtsp_sess *sessp);
 int handle_rtp_pkt(struct rtsp_sess *sessp, enum media_type media,
                    char *data, unsigned int sz);
 
@@ -16,12 +16,74 @@
 #include "send_queue.h"
 #include "sd_handler.h"
 #include "parser.h"
+#include "sess_cache.h"
 
 
 #define CONN_TIMEOUT    5
 #define RECONN_INTERVAL 5
 
 
+/**
+ * Return the number of media which is described in SDP
+ * but hasn't been SETUP yet.
+ */
+static int media_to_setup(struct rtsp_sess *sessp)
+{
+    int i = 0;
+    int num = 0;
+
+    for (i = 0; i < 2; i++) {
+        if (sessp->sdp_info->sdp_m[i].enable && !sessp->rtp_rtcp[i].enable) {
+            num++;
+        }
+    }
+    return num;
+}
+
+/**
+ * In pipelined mode, requests not depending on the response of
+ * the one just sent are sent right behind it without waiting:
+ *
+ *   OPTIONS -> DESCRIBE
+ *   SETUP   -> SETUP of the other media -> PLAY
+ *
+ * SETUP is pipelined only when we've got the session ID, otherwise
+ * the server may create one more session for the next SETUP.
+ */
+static void pipeline_rtsp_req(struct rtsp_sess *sessp)
+{
+    int i = 0;
+
+    switch (sessp->todo) {
+    case RTSP_METHOD_OPTIONS:
+        if (!sessp->sdp_info) {
+            /*
+             * Almost all servers support DESCRIBE,
+             * assume it to save one round trip.
+             */
+            sessp->supported_method[RTSP_METHOD_DESCRIBE].supported = 1;
+            sessp->todo = RTSP_METHOD_DESCRIBE;
+            send_method_describe(sessp);
+        }
+        break;
+    case RTSP_METHOD_SETUP:
+        if (!sessp->sess_id) {
+            break;
+        }
+        for (i = 0; i < 2 && media_to_setup(sessp); i++) {
+            send_method_setup(sessp);
+        }
+        if (!media_to_setup(sessp)) {
+            sessp->todo = RTSP_METHOD_PLAY;
+            send_method_play(sessp);
+        }
+        break;
+    default:
+        break;
+    }
+    return;
+}
+
 /**
  * Start RTSP interactive to play the media stream.
  */
@@ -78,11 +140,66 @@ static void start_playing(struct rtsp_sess *sessp)
     /* Send the RTSP method request. */
     if (sessp->todo != RTSP_METHOD_NONE) {
         send_method[sessp->todo](sessp);
+        if (sessp->chn_info.flags & CHN_FLAG_PIPELINE) {
+            pipeline_rtsp_req(sessp);
+        }
     }
 
     return;
 }
 
+/**
+ * Keepalive the RTSP session while playing.
+ *
+ * The interval is half of the session timeout told by server.
+ * GET_PARAMETER is preferred to OPTIONS if the server supports it,
+ * and no request is needed at all while RTCP keeps the session alive.
+ *
+ * Return -1 if the session isn't alive any longer.
+ */
+static int keepalive_rtsp_sess(struct rtsp_sess *sessp, unsigned long long now)
+{
+    unsigned long long intvl = (unsigned long long)sessp->sess_timeout * MILLION / 2;
+
+    if (intvl < MILLION) {
+        intvl = MILLION;
+    }
+
+    send_rtcp_rr(sessp, now);
+
+    /* check whether the session is alive */
+    if (now > sessp->last_recv &&
+        now - sessp->last_recv >= RECV_TIMEOUT * MILLION) {
+        printd(WARNING "Received nothing for %d seconds!\n", RECV_TIMEOUT);
+        return -1;
+    }
+
+    if (now >= sessp->last_keepalive && now - sessp->last_keepalive < intvl) {
+        return 0;
+    }
+    sessp->last_keepalive = now;
+
+    if (rtcp_keeps_alive(sessp, now)) {
+        sessp->keepalive_cnt = 0;
+        return 0;
+    }
+
+    if (sessp->keepalive_cnt >= KEEPALIVE_CNT) {
+        sessp->keepalive_cnt = 0;
+        printd(WARNING "The RTSP session isn't alive any longer!\n");
+        return -1;
+    }
+    if (sessp->supported_method[RTSP_METHOD_GET_PARAMETER].supported) {
+        sessp->todo = RTSP_METHOD_GET_PARAMETER;
+        send_method_get_parameter(sessp);
+    } else {
+        sessp->todo = RTSP_METHOD_OPTIONS;
+        send_method_options(sessp);
+    }
+    sessp->keepalive_cnt++;
+    return 0;
+}
+
 /**
  * Main loop of RTSP session will excute this in each loop.
  */
@@ -98,19 +215,10 @@ static int single_step(struct rtsp_sess *sessp)
 
     /* keepalive RTSP session */
     now = time_now();
-    if ((sessp->rtsp_state == RTSP_STATE_PLAYING) &&
-        (now < sessp->last_keepalive || (now - sessp->last_keepalive >=
-                                         KEEPALIVE_INTVL * MILLION))) {
-        /* check whether the session is alive */
-        if (sessp->keepalive_cnt >= KEEPALIVE_CNT) {
-            sessp->keepalive_cnt = 0;
-            printd(WARNING "The RTSP session isn't alive any longer!\n");
+    if (sessp->rtsp_state == RTSP_STATE_PLAYING) {
+        if (keepalive_rtsp_sess(sessp, now) < 0) {
             return -1;
         }
-        sessp->todo = RTSP_METHOD_OPTIONS;
-        send_method_options(sessp);
-        sessp->last_keepalive = now;
-        sessp->keepalive_cnt++;
     }
 
     if (check_send_queue(sessp) < 0) {
@@ -120,7 +228,7 @@ static int single_step(struct rtsp_sess *sessp)
     /* Wait event notifications. */
     do {
         nfds = epoll_wait(sessp->ep_fd, sessp->ep_ev,
-                          EPOLL_MAX_EVS, KEEPALIVE_INTVL * THOUSAND);
+                          EPOLL_MAX_EVS, EPOLL_TIMEOUT * THOUSAND);
     } while (nfds < 0 && errno == EINTR);
     if (nfds < 0) {
         perrord(ERR "epoll_wait() for listen socket error");
@@ -153,25 +261,26 @@ static int single_step(struct rtsp_sess *sessp)
         }
     }
 
+    /* Frames completed in this iteration go by one call. */
+    if (sessp->frm_batch) {
+        flush_frm_batch(sessp->frm_batch);
+    }
     return 0;
 }
 
-static void cleanup_before_reconn(struct rtsp_sess *sessp)
+/**
+ * Forget everything negotiated with the server,
+ * so that the RTSP interactive starts from `OPTIONS' again.
+ */
+static void reset_rtsp_interactive(struct rtsp_sess *sessp)
 {
     int i = 0;
 
     sessp->rtsp_state = RTSP_STATE_INIT;
     sessp->handling_state = HANDLING_STATE_INIT;
     sessp->todo = RTSP_METHOD_NONE;
-    sessp->cur_cseq = 0;
     sessp->sess_id = 0;
 
-    close(sessp->ep_fd);
-    sessp->ep_fd = -1;
-
-    close(sessp->rtsp_sock.sd);
-    sessp->rtsp_sock.sd = -1;
-
     for (i = 0; i < 2; i++) {
         close(sessp->rtp_rtcp[i].udp.rtp_sock.sd);
         sessp->rtp_rtcp[i].udp.rtp_sock.sd = -1;
@@ -179,17 +288,40 @@ static void cleanup_before_reconn(struct rtsp_sess *sessp)
         sessp->rtp_rtcp[i].udp.rtcp_sock.sd = -1;
 
         sessp->rtp_rtcp[i].enable = 0;
+        sessp->rtp_rtcp[i].ready = 0;
     }
+    memset(sessp->rtcp_stat, 0, sizeof(sessp->rtcp_stat));
+    sessp->last_rtcp_rr = 0;
+    sessp->sess_timeout = DFL_SESS_TIMEOUT;
 
     for (i = 0; i < RTSP_METHOD_NUM; i++) {
         sessp->supported_method[i].supported = 0;
     }
+    sessp->pending_num = 0;
+
+    free_sdp_info(sessp->sdp_info);
+    sessp->sdp_info = NULL;
+    sessp->cache_used = 0;
+    return;
+}
+
+static void cleanup_before_reconn(struct rtsp_sess *sessp)
+{
+    reset_rtsp_interactive(sessp);
+    sessp->cur_cseq = 0;
+
+    close(sessp->ep_fd);
+    sessp->ep_fd = -1;
+
+    close(sessp->rtsp_sock.sd);
+    sessp->rtsp_sock.sd = -1;
 
-    sessp->rtsp_state = RTSP_STATE_INIT;
     sessp->keepalive_cnt = 0;
     sessp->last_keepalive = 0;
 
-    freez(sessp->sdp_info);
+    /* Drop any partial message of the broken connection. */
+    sessp->last_data.sz = 0;
+    sessp->last_data.state = RECV_STATE_START;
     return;
 }
 
@@ -242,6 +374,9 @@ static void *rtsp_sess_thrd(void *arg)
             goto rtn;
         }
 
+        /* Skip OPTIONS & DESCRIBE if we've played the URI before. */
+        load_sess_cache(sessp);
+
         /* The main loop of RTSP session. */
         while (sessp->enable) {
             if (reconn) {
@@ -262,6 +397,147 @@ rtn:
     return NULL;
 }
 
+/**
+ * Whether channels can share one session, they must get the same frames.
+ */
+static int same_chn_cfg(const struct chn_info *a, const struct chn_info *b)
+{
+    return a->frm_hdr_sz == b->frm_hdr_sz && a->flags == b->flags &&
+        a->aud_intvl == b->aud_intvl && a->decim_mode == b->decim_mode &&
+        a->decim_gop == b->decim_gop && a->max_delay == b->max_delay;
+}
+
+/**
+ * Find the session a channel can share, sessions whose last holder
+ * has left are being torn down and can't be joined.
+ * Channels in pull mode aren't shared, their ring has only one consumer.
+ * Must be called with rtsp_cli.list_mutex held.
+ */
+struct rtsp_sess *find_rtsp_sess(const char *uri, const struct chn_info *chnp, int intlvd)
+{
+    struct rtsp_sess *sessp = NULL;
+
+    if (chnp->flags & CHN_FLAG_PULL) {
+        return NULL;
+    }
+    list_for_each_entry(sessp, &rtsp_cli.rtsp_sess_list, entry) {
+        if (sessp->enable && sessp->ref &&
+            sessp->intlvd_mode == intlvd && !strcmp(sessp->uri, uri) &&
+            same_chn_cfg(&sessp->chn_info, chnp)) {
+            return sessp;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Add a channel, or a recorder, to the session,
+ * it's primed with the GOP cache first.
+ * The caller holds a reference of the session, but not
+ * rtsp_cli.list_mutex, unless nobody else can see the session yet.
+ */
+struct rtsp_sub *add_rtsp_sub(struct rtsp_sess *sessp, const struct chn_info *chnp,
+                              struct recorder *recp)
+{
+    struct rtsp_sub *subp = NULL;
+
+    subp = mallocz(sizeof(*subp));
+    if (!subp) {
+        printd(ERR "Allocate memory for struct rtsp_sub failed!\n");
+        return NULL;
+    }
+    subp->sessp = sessp;
+    memcpy(&subp->chn_info, chnp, sizeof(*chnp));
+    subp->recp = recp;
+
+    pthread_mutex_lock(&sessp->sub_mutex);
+    prime_rtsp_sub(subp);
+    list_add_tail(&subp->entry, &sessp->sub_list);
+    pthread_mutex_unlock(&sessp->sub_mutex);
+    return subp;
+}
+
+/**
+ * Remove and free the subscriber, its reference
+ * of the session is dropped by put_rtsp_sess().
+ */
+void del_rtsp_sub(struct rtsp_sub *subp)
+{
+    struct rtsp_sess *sessp = subp->sessp;
+
+    pthread_mutex_lock(&sessp->sub_mutex);
+    list_del(&subp->entry);
+    pthread_mutex_unlock(&sessp->sub_mutex);
+    freez(subp);
+    return;
+}
+
+/**
+ * Drop a reference of the session, the last one tears it down.
+ * It's marked dying under rtsp_cli.list_mutex, so no channel
+ * opened meanwhile can join it.
+ */
+void put_rtsp_sess(struct rtsp_sess *sessp)
+{
+    unsigned int left = 0;
+
+    pthread_mutex_lock(&rtsp_cli.list_mutex);
+    left = --sessp->ref;
+    if (!left) {
+        sessp->todo = RTSP_METHOD_TEARDOWN;
+    }
+    pthread_mutex_unlock(&rtsp_cli.list_mutex);
+    if (left) {
+        return;
+    }
+
+    send_method_teardown(sessp);
+    return;
+}
+
+static void free_rtsp_subs(struct rtsp_sess *sessp)
+{
+    struct rtsp_sub *subp = NULL;
+    struct rtsp_sub *tmp = NULL;
+
+    list_for_each_entry_safe(subp, tmp, &sessp->sub_list, entry) {
+        list_del(&subp->entry);
+        if (subp->recp) {
+            destroy_recorder(subp->recp);   /* not stopped by user, finish the file */
+        }
+        freez(subp);
+    }
+    deinit_gop_cache(&sessp->gop_cache);
+    pthread_mutex_destroy(&sessp->sub_mutex);
+    return;
+}
+
+/**
+ * Pass the frame on to every channel sharing the session.
+ * Callback mustn't open or close channels of the same stream.
+ */
+void store_sess_frm(struct rtsp_sess *sessp, struct frm_info *frmp)
+{
+    struct rtsp_sub *subp = NULL;
+
+    pthread_mutex_lock(&sessp->sub_mutex);
+    cache_gop_frm(sessp, frmp);
+    list_for_each_entry(subp, &sessp->sub_list, entry) {
+        if (subp->recp) {
+            put_rec_frm(subp->recp, frmp);
+            continue;
+        }
+        rtsp_cli.store_frm(&subp->chn_info, frmp);
+    }
+    pthread_mutex_unlock(&sessp->sub_mutex);
+    return;
+}
+
+/**
+ * Create the session and add it to the list, its reference is held
+ * by the channel opening it. Must be called with rtsp_cli.list_mutex
+ * held, so a channel opened meanwhile joins it instead of creating another.
+ */
 struct rtsp_sess *create_rtsp_sess(char *uri, struct sockaddr_in *srv_addrp,
                                    struct chn_info *chnp, int intlvd)
 {
@@ -288,10 +564,15 @@ struct rtsp_sess *create_rtsp_sess(char *uri, struct sockaddr_in *srv_addrp,
     sessp->handling_state = HANDLING_STATE_INIT;
     sessp->todo = RTSP_METHOD_NONE;
     sessp->cur_cseq = 0;
+    sessp->sess_timeout = DFL_SESS_TIMEOUT;
+    sessp->ssrc = (unsigned int)time_now() ^ (unsigned int)(unsigned long)sessp;
     memcpy(&sessp->srv_addr, srv_addrp, sizeof(*srv_addrp));
     memcpy(&sessp->chn_info, chnp, sizeof(*chnp));
     sessp->intlvd_mode = intlvd;
     INIT_LIST_HEAD(&sessp->send_queue);
+    INIT_LIST_HEAD(&sessp->sub_list);
+    pthread_mutex_init(&sessp->sub_mutex, NULL);
+    init_gop_cache(&sessp->gop_cache, chnp->gop_cache_sz);
 
     strncpy(sessp->uri, uri, sizeof(sessp->uri) - 1);
 
@@ -318,28 +599,93 @@ struct rtsp_sess *create_rtsp_sess(char *uri, struct sockaddr_in *srv_addrp,
     sessp->last_data.sz = 0;
 
     /* Allocate memory for buffer storing current frame. */
-    sessp->frm_info.frm_buf = mallocz(MAX_FRM_SZ);
-    if (!sessp->frm_info.frm_buf) {
-        printd(EMERG "Allocate memory for storing frame failed!\n");
+    if (init_frm_ctx(&sessp->frm_ctx[MEDIA_TYPE_VIDEO], MAX_FRM_SZ) < 0) {
+        freez(sessp->last_data.buf);
+        freez(sessp);
+        return NULL;
+    }
+    if (init_frm_ctx(&sessp->frm_ctx[MEDIA_TYPE_AUDIO],
+                     chnp->frm_hdr_sz + MAX_AUD_FRM_SZ) < 0) {
+        deinit_frm_ctx(&sessp->frm_ctx[MEDIA_TYPE_VIDEO]);
         freez(sessp->last_data.buf);
         freez(sessp);
         return NULL;
     }
 
-    /* Create thread for each RTSP session. */
-    if ((ret = pthread_create(&sessp->rtsp_sess_tid, NULL,
-                              rtsp_sess_thrd, sessp)) != 0) {
-        printd(EMERG "Create thread rtsp_sess_thrd error: %s\n", strerror(ret));
+    /* Arena for objects made while handling RTSP messages. */
+    if (init_arena(&sessp->arena, ARENA_CHUNK_SZ) < 0) {
+        deinit_frm_ctx(&sessp->frm_ctx[MEDIA_TYPE_AUDIO]);
+        deinit_frm_ctx(&sessp->frm_ctx[MEDIA_TYPE_VIDEO]);
         freez(sessp->last_data.buf);
-        freez(sessp->frm_info.frm_buf);
         freez(sessp);
         return NULL;
     }
 
-    /* Add to RTSP session list. */
-    pthread_mutex_lock(&rtsp_cli.list_mutex);
+    /* Shared memory ring for reader processes. */
+    if ((chnp->flags & CHN_FLAG_SHM) && create_shm_ring(sessp) < 0) {
+        deinit_arena(&sessp->arena);
+        deinit_frm_ctx(&sessp->frm_ctx[MEDIA_TYPE_AUDIO]);
+        deinit_frm_ctx(&sessp->frm_ctx[MEDIA_TYPE_VIDEO]);
+        freez(sessp->last_data.buf);
+        freez(sessp);
+        return NULL;
+    }
+
+    /* Frames completed in one iteration of event loop, deliver threads batch by themselves. */
+    if ((chnp->flags & CHN_FLAG_BATCH) &&
+        !(chnp->flags & (CHN_FLAG_PACING | CHN_FLAG_PULL | CHN_FLAG_ASYNC))) {
+        sessp->frm_batch = mallocz(sizeof(*sessp->frm_batch));
+        if (!sessp->frm_batch) {
+            printd(EMERG "Allocate memory for frame batch failed!\n");
+            destroy_shm_ring(sessp);
+            deinit_arena(&sessp->arena);
+            deinit_frm_ctx(&sessp->frm_ctx[MEDIA_TYPE_AUDIO]);
+            deinit_frm_ctx(&sessp->frm_ctx[MEDIA_TYPE_VIDEO]);
+            freez(sessp->last_data.buf);
+            freez(sessp);
+            return NULL;
+        }
+    }
+
+    /* Ring to pass frames on out of the session thread. */
+    if (((chnp->flags & CHN_FLAG_PULL) ||
+         ((chnp->flags & CHN_FLAG_ASYNC) && !(chnp->flags & CHN_FLAG_PACING))) &&
+        attach_deliver_ring(sessp) < 0) {
+        freez(sessp->frm_batch);
+        destroy_shm_ring(sessp);
+        deinit_arena(&sessp->arena);
+        deinit_frm_ctx(&sessp->frm_ctx[MEDIA_TYPE_AUDIO]);
+        deinit_frm_ctx(&sessp->frm_ctx[MEDIA_TYPE_VIDEO]);
+        freez(sessp->last_data.buf);
+        freez(sessp);
+        return NULL;
+    }
+
+    /* The channel opening the session is its first subscriber. */
+    if (!add_rtsp_sub(sessp, chnp, NULL)) {
+        ret = ENOMEM;
+    }
+
+    /* Add to RTSP session list, the caller holds its reference. */
+    sessp->ref = 1;
     list_add_tail(&sessp->entry, &rtsp_cli.rtsp_sess_list);
-    pthread_mutex_unlock(&rtsp_cli.list_mutex);
+
+    /* Create thread for each RTSP session. */
+    if (ret || (ret = pthread_create(&sessp->rtsp_sess_tid, NULL,
+                                     rtsp_sess_thrd, sessp)) != 0) {
+        printd(EMERG "Create thread rtsp_sess_thrd error: %s\n", strerror(ret));
+        list_del(&sessp->entry);
+        free_rtsp_subs(sessp);
+        detach_deliver_ring(sessp);
+        freez(sessp->frm_batch);
+        destroy_shm_ring(sessp);
+        deinit_arena(&sessp->arena);
+        freez(sessp->last_data.buf);
+        deinit_frm_ctx(&sessp->frm_ctx[MEDIA_TYPE_AUDIO]);
+        deinit_frm_ctx(&sessp->frm_ctx[MEDIA_TYPE_VIDEO]);
+        freez(sessp);
+        return NULL;
+    }
 
     return sessp;
 }
@@ -349,27 +695,39 @@ void destroy_rtsp_sess(struct rtsp_sess *sessp)
     int found = 0;
     struct rtsp_sess *tmp = NULL;
 
+    pthread_mutex_lock(&rtsp_cli.list_mutex);
     list_for_each_entry(tmp, &rtsp_cli.rtsp_sess_list, entry) {
         if (tmp == sessp) {
             found = 1;
             break;
         }
     }
+    if (found) {
+        list_del(&sessp->entry);
+    }
+    pthread_mutex_unlock(&rtsp_cli.list_mutex);
 
     if (!found) {
         return;
     }
 
-    pthread_mutex_lock(&rtsp_cli.list_mutex);
-    list_del(&sessp->entry);
-    pthread_mutex_unlock(&rtsp_cli.list_mutex);
-
     close(sessp->rtsp_sock.sd);
     close(sessp->ep_fd);
 
-    freez(sessp->sdp_info);
+    drop_playout_frm(sessp);
+    detach_deliver_ring(sessp);
+    if (sessp->frm_batch) {
+        flush_frm_batch(sessp->frm_batch);
+        freez(sessp->frm_batch);
+    }
+    destroy_shm_ring(sessp);
+    free_rtsp_subs(sessp);
+
+    free_sdp_info(sessp->sdp_info);
+    deinit_arena(&sessp->arena);
     freez(sessp->ep_ev);
-    freez(sessp->frm_info.frm_buf);
+    deinit_frm_ctx(&sessp->frm_ctx[MEDIA_TYPE_AUDIO]);
+    deinit_frm_ctx(&sessp->frm_ctx[MEDIA_TYPE_VIDEO]);
     freez(sessp->last_data.buf);
     freez(sessp);
     return;
@@ -402,19 +760,60 @@ void free_rtsp_req(struct rtsp_req *req)
     freez(req);
 }
 
-static int run_rtsp_state_machine(struct rtsp_sess *sessp, struct rtsp_resp *resp)
+/**
+ * Remember the request sent, its response is matched by CSeq.
+ * If there're too many, the oldest one is given up.
+ */
+void add_pending_req(struct rtsp_sess *sessp, enum rtsp_method method, unsigned int cseq)
 {
-    int i = 0;
+    if (sessp->pending_num == MAX_PENDING_REQ) {
+        printd(WARNING "Too many requests waiting for response!\n");
+        memmove(&sessp->pending_req[0], &sessp->pending_req[1],
+                sizeof(sessp->pending_req[0]) * (MAX_PENDING_REQ - 1));
+        sessp->pending_num--;
+    }
+    sessp->pending_req[sessp->pending_num].cseq = cseq;
+    sessp->pending_req[sessp->pending_num].method = method;
+    sessp->pending_num++;
+    return;
+}
 
-    if (resp->resp_hdr.cseq != sessp->cur_cseq) {
-        printd(WARNING "The CSeq of response not matches the request one.\n");
-        return -1;
+/**
+ * Find the request which the response with @cseq belongs to,
+ * and remove it from pending requests.
+ *
+ * Return the RTSP method of the request, RTSP_METHOD_NONE if not found.
+ */
+static enum rtsp_method take_pending_req(struct rtsp_sess *sessp, unsigned int cseq)
+{
+    enum rtsp_method method = RTSP_METHOD_NONE;
+    unsigned int i = 0;
+
+    for (i = 0; i < sessp->pending_num; i++) {
+        if (sessp->pending_req[i].cseq == cseq) {
+            method = sessp->pending_req[i].method;
+            memmove(&sessp->pending_req[i], &sessp->pending_req[i + 1],
+                    sizeof(sessp->pending_req[0]) * (sessp->pending_num - i - 1));
+            sessp->pending_num--;
+            break;
+        }
     }
+    return method;
+}
+
+static int run_rtsp_state_machine(struct rtsp_sess *sessp, struct rtsp_resp *resp,
+                                  enum rtsp_method method)
+{
+    int i = 0;
+
     if (resp->resp_hdr.sess_id) {
         sessp->sess_id = resp->resp_hdr.sess_id;
     }
+    if (resp->resp_hdr.sess_timeout) {
+        sessp->sess_timeout = resp->resp_hdr.sess_timeout;
+    }
 
-    switch (sessp->todo) {
+    switch (method) {
     case RTSP_METHOD_OPTIONS:
         /* for keepalive message */
         sessp->keepalive_cnt = 0;
@@ -426,21 +825,18 @@ static int run_rtsp_state_machine(struct rtsp_sess *sessp, struct rtsp_resp *res
         }
         break;
     case RTSP_METHOD_DESCRIBE:
-        sessp->sdp_info = resp->sdp_info;
-        break;
-    case RTSP_METHOD_SETUP:
-        /* All media sessions were setup? */
-        for (i = 0; i < 2; i++) {
-            if (sessp->sdp_info->sdp_m[i].enable) {
-                if (!sessp->rtp_rtcp[i].enable) {
-                    break;
-                }
-            }
+        if (!resp->sdp_info) {
+            printd(WARNING "No SDP in response of DESCRIBE!\n");
+            return -1;
         }
-        if (i == 2) {
-            sessp->rtsp_state = RTSP_STATE_READY;
+        free_sdp_info(sessp->sdp_info);
+        sessp->sdp_info = dup_sdp_info(resp->sdp_info);
+        if (!sessp->sdp_info) {
+            return -1;
         }
-        
+        break;
+    case RTSP_METHOD_SETUP:
+        /* Find out which media the response belongs to. */
         if (!sessp->intlvd_mode) {
             struct sockaddr_in *tmp_sap = NULL;
             for (i = 0; i < 2; i++) {
@@ -457,21 +853,46 @@ static int run_rtsp_state_machine(struct rtsp_sess *sessp, struct rtsp_resp *res
                 printd("RTP/RTCP port of client in request and response is unmatched!\n");
                 return -1;
             }
+        } else {
+            i = resp->resp_hdr.transport.rtp_chn / 2;
+            if (i < 0 || i >= 2) {
+                printd("Interleaved channel in response is unmatched!\n");
+                return -1;
+            }
+        }
+        sessp->rtp_rtcp[i].ready = 1;
+
+        /* All media sessions were setup? */
+        for (i = 0; i < 2; i++) {
+            if (sessp->sdp_info->sdp_m[i].enable) {
+                if (!sessp->rtp_rtcp[i].ready) {
+                    break;
+                }
+            }
+        }
+        if (i == 2) {
+            sessp->rtsp_state = RTSP_STATE_READY;
         }
         break;
     case RTSP_METHOD_PLAY:
         sessp->rtsp_state = RTSP_STATE_PLAYING;
+        sessp->last_keepalive = time_now();
+        load_pt_map(sessp);
+        save_sess_cache(sessp);
+        sessp->cache_used = 0;      /* cache proved good, later errors aren't about it */
         break;
     case RTSP_METHOD_PAUSE:
         break;
     case RTSP_METHOD_GET_PARAMETER:
+        /* for keepalive message */
+        sessp->keepalive_cnt = 0;
         break;
     case RTSP_METHOD_SET_PARAMETER:
         break;
     case RTSP_METHOD_TEARDOWN:
         break;
     default:
-        printd("Unsupported RTSP method[%d]!\n", sessp->todo);
+        printd("Unsupported RTSP method[%d]!\n", method);
         return -1;
     }
 
@@ -480,23 +901,53 @@ static int run_rtsp_state_machine(struct rtsp_sess *sessp, struct rtsp_resp *res
 
 /**
  * Parse the RTSP response message, and run the RTSP state machine.
+ *
+ * All objects made while parsing are allocated from the arena
+ * of the session, and given back together when we're done.
  */
 int handle_rtsp_resp(struct rtsp_sess *sessp, const char *msg, unsigned int sz)
 {
     struct rtsp_resp *resp = NULL;
+    enum rtsp_method method = RTSP_METHOD_NONE;
+    int ret = 0;
 
-    resp = mallocz(sizeof(*resp));
+    resp = alloc_from_arena(&sessp->arena, sizeof(*resp));
     if (!resp) {
         printd("Allocate memory for struct rtsp_resp failed!\n");
         return -1;
     }
 
-    parse_rtsp_resp(sessp, resp, msg, sz);
+    ret = parse_rtsp_resp(sessp, resp, msg, sz);
+    method = take_pending_req(sessp, resp->resp_hdr.cseq);
 
-    run_rtsp_state_machine(sessp, resp);
+    if (ret < 0) {
+        /* Can't tell which request failed, give up all of them. */
+        if (method == RTSP_METHOD_NONE) {
+            sessp->pending_num = 0;
+        }
 
-    sessp->handling_state = HANDLING_STATE_INIT;
+        /*
+         * What we cached may be out of date, e.g. the track was renamed.
+         * Drop the cache and start over with the full RTSP interactive.
+         */
+        if (sessp->cache_used) {
+            printd(WARNING "Server rejected the cached SDP of %s!\n", sessp->uri);
+            drop_sess_cache(sessp->uri);
+            reset_rtsp_interactive(sessp);
+            reset_arena(&sessp->arena);
+            return 0;
+        }
+    } else if (method == RTSP_METHOD_NONE) {
+        printd(WARNING "The CSeq of response not matches any request.\n");
+    } else {
+        run_rtsp_state_machine(sessp, resp, method);
+    }
+
+    /* Go on with next request after all requests sent were responded. */
+    if (!sessp->pending_num) {
+        sessp->handling_state = HANDLING_STATE_INIT;
+    }
 
-    freez(resp);
+    reset_arena(&sessp->arena);
     return 0;
 }
@@ -18,17 +18,29 @@
 #include "rtsp_method.h"
 #include "sd_handler.h"
 #include "rtp.h"
+#include "rtcp.h"
+#include "codec_cfg.h"
+#include "playout.h"
+#include "deliver.h"
+#include "shm_ring.h"
+#include "gop_cache.h"
+#include "recorder.h"
+#include "arena.h"
 
 
 #define RTSP_VER        "RTSP/1.0" /* RTSP version. */
 #define RTSP_CLIENT     "Zmodo RTSP Client"
 #define CRLF            "\r\n"
 
-#define KEEPALIVE_INTVL     3   /* keepalive interval, second(s) */
+#define DFL_SESS_TIMEOUT    60  /* session timeout if server doesn't tell, second(s) */
 #define KEEPALIVE_CNT       3   /* max un-responsed keepalive message number */
+#define RECV_TIMEOUT        10  /* max time receiving nothing while playing, second(s) */
+#define EPOLL_TIMEOUT       3   /* timeout of waiting events, second(s) */
 
 #define EPOLL_MAX_EVS   128       /* max epoll events */
 
+#define MAX_PENDING_REQ 8         /* max requests waiting for response */
+
 /* Max URI size, example like: `rtsp://172.18.16.133:10554/av0_0'. */
 #define MAX_URI_SZ      256
 
@@ -44,12 +56,7 @@
 #define MAX_TRANSPORT_SZ        128
 #define MAX_RANGE_SZ            64
 #define MAX_USR_AGENT_SZ        64
-#define MAX_ENC_NAME_SZ         32
 #define MAX_TRACK_SZ            256
-#define MAX_PROF_LVL_ID_SZ      128
-#define MAX_SPROP_PARAM_SET_SZ  128
-#define MAX_SDP_A_NAME_SZ       16
-#define MAX_PROTO_SZ            16
 
 
 #define RECV_BUF_SZ     (100 * 1024)
@@ -75,7 +82,13 @@ enum handling_state {
 struct rtsp_cli {
     struct list_head rtsp_sess_list;
     pthread_mutex_t list_mutex; /* mutex for session list */
+    struct list_head sess_cache_list; /* SDP & public methods of played URIs */
+    pthread_mutex_t cache_mutex;      /* mutex for session cache list */
     store_frm_t store_frm;      /* callback function to store frame */
+    store_frms_t store_frms;    /* callback function to store frames in batches */
+    struct playout playout;     /* timer thread pacing frames */
+    struct deliver_pool deliver_pool;   /* threads passing frames on */
+    struct rec_writer rec_writer;   /* threads writing recordings */
 };
 
 /* RTP header. */
@@ -104,7 +117,8 @@ struct rtp_hdr {
 };
 
 struct rtp_rtcp {
-    int enable;
+    int enable;                 /* SETUP was sent */
+    int ready;                  /* SETUP was responded */
     union {
         struct tcp {            /* used in interleaved mode */
             char rtp_chn;
@@ -149,6 +163,7 @@ struct rtsp_resp {
     struct resp_hdr {
         unsigned int cseq;
         unsigned long long sess_id;
+        unsigned int sess_timeout;  /* `timeout' parameter of `Session' header */
         char date[MAX_DATE_SZ];
         char public[MAX_PUBLIC_SZ];
         char content_type[MAX_CONTENT_TYPE_SZ];
@@ -164,7 +179,7 @@ struct rtsp_resp {
         } transport;
     } resp_hdr;
     struct sdp_info *sdp_info;      /* After parsed the method `DESCRIBE',
-                                     * the sdp_info will be hung to struct rtsp_sess. */
+                                     * a copy of sdp_info will be hung to struct rtsp_sess. */
 };
 
 /* Interleaved header for transport(RTP over RTSP). */
@@ -181,56 +196,93 @@ enum intlvd_chn {
     INTLVD_CHN_RTCP_A,
 };
 
+/* state of splitting the data received from rtsp_sd into messages */
+enum recv_state {
+    RECV_STATE_START,               /* waiting for the first byte of a message */
+    RECV_STATE_INTLVD,              /* receiving an interleaved RTP/RTCP packet */
+    RECV_STATE_HDRS,                /* receiving headers of a RTSP message */
+    RECV_STATE_BODY,                /* receiving body of a RTSP message */
+};
+
 /* used for receiving data from rtsp_sd */
 struct last_data {
     char *buf;                      /* buffer used for storing un-completed data received last time */
     unsigned int sz;                /* size of data received last time */
+    enum recv_state state;          /* where we are in the current message */
+    unsigned int pos;               /* bytes in buf already scanned, never scan them again */
+    unsigned int line;              /* start of the header line being scanned */
+    unsigned int content_length;    /* value of `Content-Length' header, 0 if none */
+    unsigned int msg_sz;            /* size of current message once known */
 };
 
-/* SDP attribute description */
-struct sdp_a {
-    struct list_head entry;
-    char name[MAX_SDP_A_NAME_SZ];
-    union {
-        struct rtpmap {
-            enum rtp_pt pt;                 /* media payload type */
-            char enc_name[MAX_ENC_NAME_SZ]; /* encoding name */
-            unsigned int clk_rate;          /* clock rate */
-        } rtpmap;
-        struct control {
-            char track[MAX_TRACK_SZ];
-        } control;
-        struct range {
-            unsigned int start;
-            unsigned int end;
-        } range;
-        struct fmtp {
-            enum rtp_pt pt;     /* media payload type */
-            char packetization_mode;
-            char profile_level_id[MAX_PROF_LVL_ID_SZ];
-            char sprop_parameter_sets[MAX_SPROP_PARAM_SET_SZ];
-        } fmtp;
-    };
+/* context for assembling frames of one media */
+struct frm_ctx {
+    struct frm_info frm_info;       /* pass on to the storing frame callback */
+    unsigned int buf_sz;            /* size of frm_info.frm_buf */
+    int frm_drop;                   /* drop the frame being assembled */
+    unsigned long long nalu_seen;   /* video: bit mask of NALU types in the frame */
+    unsigned int nalu_num;          /* video: NALUs in the frame, may exceed MAX_NALU_NUM */
+    unsigned int nalu_off;          /* video: offset of the NALU being assembled */
+    int vcl_seen;                   /* video: decimation is decided at the first VCL NALU */
+    int nonref;                     /* video: the frame isn't used for reference */
+    int nalu_done;                  /* video: the last packet completed a NALU */
+    int frm_started;                /* video: part of the frame was delivered in slice mode */
+    unsigned int frm_ts;            /* RTP timestamp of the frame being assembled */
+    unsigned int clk_rate;          /* clock rate of frm_ts */
+    struct playout_clk playout_clk; /* used with CHN_FLAG_PACING */
+    int pace_shed;                  /* CHN_FLAG_PACING with PULL, wait for key frame */
+    unsigned int gop_cnt;           /* video: GOPs seen, for DECIM_GOP */
+    int gop_keep;                   /* video: keep the current GOP, for DECIM_GOP */
+    struct nalu_info nalu[MAX_NALU_NUM];    /* video: index of NALUs in the frame */
+    unsigned int next_ts;           /* audio: RTP timestamp of the next continuous packet */
+    unsigned int ts_left;           /* audio: timestamp units left in the batching window */
 };
 
 /* SDP media description */
 struct sdp_m {
     int enable;
     int port;
-    char proto[MAX_PROTO_SZ];
+    char *proto;
     enum rtp_pt pt;
-    struct list_head sdp_a_list;
-    
+    struct rtpmap {                 /* a=rtpmap */
+        enum rtp_pt pt;             /* media payload type */
+        char *enc_name;             /* encoding name */
+        unsigned int clk_rate;      /* clock rate */
+    } rtpmap;
+    char *control;                  /* a=control, NULL if absent */
+    struct fmtp {                   /* a=fmtp */
+        enum rtp_pt pt;             /* media payload type */
+        int packetization_mode;
+        char *profile_level_id;
+        char *sprop_parameter_sets; /* base64 SPS & PPS separated by ',' */
+        char *sprop_vps;            /* H.265 only */
+        char *sprop_sps;
+        char *sprop_pps;
+    } fmtp;
 };
 
 /*
  * Actually, the struct definition is incomplete.
  * Just define what we need.
+ *
+ * While parsing, the struct and its strings live in the arena of
+ * the session. The copy kept by the session is made by dup_sdp_info(),
+ * which puts the strings right after the struct in one memory block.
+ * The copy is never modified, and is freed by free_sdp_info().
  */
 struct sdp_info {
+    unsigned int sz;            /* size of the whole memory block */
     struct sdp_m sdp_m[2];      /* 0: video; 1: audio */
 };
 
+/* A channel opened by user, channels of one stream share the session. */
+struct rtsp_sub {
+    struct list_head entry;         /* entry of subscriber list of session */
+    struct rtsp_sess *sessp;
+    struct chn_info chn_info;       /* passed to callback */
+    struct recorder *recp;          /* frames are recorded instead, see start_rec() */
+};
+
 /* Each RTSP session has this struct to store its information. */
 struct rtsp_sess {
     struct list_head entry;         /* entry of RTSP session list */
@@ -240,15 +292,24 @@ struct rtsp_sess {
     pthread_t rtsp_sess_tid;        /* thread ID of RTSP session thread */
     unsigned long long sess_id;     /* RTSP session ID */
     unsigned int cur_cseq;          /* CSeq used in current RTSP interactive */
-    enum rtsp_method todo;          /* current handling RTSP method */
+    enum rtsp_method todo;          /* RTSP method sent last time */
+    struct pending_req {            /* requests waiting for response */
+        unsigned int cseq;
+        enum rtsp_method method;
+    } pending_req[MAX_PENDING_REQ];
+    unsigned int pending_num;
     enum handling_state handling_state; /* RTSP method to do this time */
     enum rtsp_state rtsp_state;     /* used in RTSP state machine */
     int intlvd_mode;                /* interleaved mode */
     int ep_fd;                      /* epoll file descriptor */
     struct epoll_event *ep_ev;      /* epoll event */
 
+    unsigned int sess_timeout;      /* session timeout told by server, second(s) */
     unsigned long long last_keepalive; /* last time of sending keepalive message */
     unsigned keepalive_cnt;     /* current un-responsed keepalive message */
+    unsigned long long last_recv;   /* last time of receiving anything */
+    unsigned long long last_rtcp_rr;    /* last time of sending RTCP RR */
+    unsigned int ssrc;              /* our SSRC in RTCP */
 
     struct supported_method {       /* RTSP method supported by RTSP server */
         enum rtsp_method method;
@@ -256,13 +317,29 @@ struct rtsp_sess {
     } supported_method[RTSP_METHOD_NUM];
 
     struct chn_info chn_info;       /* information of remote channel */
-    struct frm_info frm_info;       /* information of frame, pass on to the storing frame callback */
+    struct list_head sub_list;      /* channels sharing the session */
+    pthread_mutex_t sub_mutex;      /* protects sub_list, not waited for under list_mutex */
+    unsigned int ref;               /* channels & recorders holding it, protected by
+                                       rtsp_cli.list_mutex, torn down when it drops to 0 */
+    struct gop_cache gop_cache;     /* primes channels joining, protected by sub_mutex */
+    struct frm_ctx frm_ctx[2];      /* assembling video & audio frames */
+    struct pt_map pt_map[2][RTP_PT_NUM];    /* depacketizer of each payload type, per media */
+    enum video_codec video_codec;   /* from a=rtpmap of video */
+    struct param_sets param_sets;   /* (VPS,) SPS & PPS from SDP */
+    char codec_cfg[MAX_CODEC_CFG_SZ];   /* avcC or hvcC built from param_sets */
+    int codec_cfg_sz;               /* -1 if unavailable */
+    struct deliver_ring *deliver_ring;  /* used with CHN_FLAG_ASYNC */
+    struct frm_batch *frm_batch;    /* used with CHN_FLAG_BATCH, flushed once per iteration */
+    struct shm_ring *shm_ring;      /* used with CHN_FLAG_SHM */
 
     struct last_data last_data;
+    struct arena arena;             /* objects used while handling one RTSP message */
     struct list_head send_queue;    /* a list keeps send buffers to be sent out */
     struct sock rtsp_sock;          /* used in RTSP interactive & interleaved mode */
     struct sdp_info *sdp_info;      /* session description information */
+    int cache_used;                 /* sdp_info & supported_method come from sess_cache, till PLAY */
     struct rtp_rtcp rtp_rtcp[2];    /* struct store RTP & RTCP information */
+    struct rtcp_stat rtcp_stat[2];  /* statistics of RTP for RTCP RR */
 };
 
 /* Global variable shared in the library. */
@@ -271,9 +348,16 @@ extern struct rtsp_cli rtsp_cli;
 struct rtsp_sess *create_rtsp_sess(char *uri, struct sockaddr_in *srv_addrp,
                                    struct chn_info *chnp, int intlvd);
 void destroy_rtsp_sess(struct rtsp_sess *sessp);
+struct rtsp_sess *find_rtsp_sess(const char *uri, const struct chn_info *chnp, int intlvd);
+struct rtsp_sub *add_rtsp_sub(struct rtsp_sess *sessp, const struct chn_info *chnp,
+                              struct recorder *recp);
+void del_rtsp_sub(struct rtsp_sub *subp);
+void put_rtsp_sess(struct rtsp_sess *sessp);
+void store_sess_frm(struct rtsp_sess *sessp, struct frm_info *frmp);
 
 struct rtsp_req *alloc_rtsp_req(enum rtsp_method method, unsigned int cseq);
 void free_rtsp_req(struct rtsp_req *req);
+void add_pending_req(struct rtsp_sess *sessp, enum rtsp_method method, unsigned int cseq);
 
 int handle_rtsp_resp(struct rtsp_sess *sessp, const char *msg, unsigned int sz);
 
@@ -107,6 +107,7 @@ static int produce_rtsp_req(struct rtsp_sess *sessp, struct rtsp_req *req)
     print_rtsp_msg(sendp->buf, sendp->sz);
 
     list_add_tail(&sendp->entry, &sessp->send_queue);
+    add_pending_req(sessp, req->req_line.method, req->req_hdr.cseq);
 
     return 0;
 
@@ -116,15 +117,12 @@ static int produce_rtsp_req(struct rtsp_sess *sessp, struct rtsp_req *req)
 void make_rtsp_uri(struct rtsp_sess *sessp, char *uri, unsigned int sz, enum media_type media)
 {
     char track[MAX_TRACK_SZ] = {0};
-    struct sdp_a *ap = NULL;
 
     if (sessp->todo == RTSP_METHOD_SETUP) {
         if (sessp->sdp_info) {
-            list_for_each_entry(ap, &sessp->sdp_info->sdp_m[media].sdp_a_list, entry) {
-                if (!strncmp(ap->name, "control", strlen("control"))) {
-                    memcpy(track, ap->control.track, sizeof(track));
-                    break;
-                }
+            if (sessp->sdp_info->sdp_m[media].control) {
+                snprintf(track, sizeof(track), "%s",
+                         sessp->sdp_info->sdp_m[media].control);
             }
             if (track[0] == '\0') {
                 snprintf(track, sizeof(track), "track%d", media);
@@ -407,13 +405,35 @@ int send_method_pause(struct rtsp_sess *sessp)
     return 0;
 }
 
+/**
+ * GET_PARAMETER without body is used as keepalive message.
+ */
 int send_method_get_parameter(struct rtsp_sess *sessp)
 {
+    struct rtsp_req *req = NULL;
+    int ret = 0;
+
     if (!sessp->supported_method[RTSP_METHOD_GET_PARAMETER].supported) {
         return 0;
     }
 	sessp->handling_state = HANDLING_STATE_DOING;
-    return 0;
+
+    /* RTSP request */
+    req = alloc_rtsp_req(RTSP_METHOD_GET_PARAMETER, sess_cseq(sessp));
+    if (!req) {
+        return -1;
+    }
+    req->req_hdr.sess_id = sessp->sess_id;
+
+    /* Fill RTSP request. */
+    make_rtsp_uri(sessp, req->req_line.uri, sizeof(req->req_line.uri), 0);
+
+    if (produce_rtsp_req(sessp, req) < 0) {
+        ret = -1;
+    }
+    free_rtsp_req(req);
+
+    return ret;
 }
 
 int send_method_set_parameter(struct rtsp_sess *sessp)
@@ -65,113 +65,139 @@ static int handle_intlvd_data(struct rtsp_sess *sessp, char *data, unsigned sz)
 }
 
 /**
- * @brief: Check whether it's a complete RTSP message.
+ * @brief: Split the data in last_data into RTSP messages and
+ *         interleaved RTP/RTCP packets, and handle each of them.
  *
- * Return 1 if complete, 0 if incomplete.
+ * The position of scanning is kept in last_data across recv() calls,
+ * so each byte is scanned only once no matter how many segments
+ * a message arrives in. A RTSP message is handled only when its
+ * headers and the whole body given by `Content-Length' are received.
+ *
+ * Return 0 if OK, -1 if the message is too large to be buffered.
  */
-static int rtsp_msg_complete(char *data, unsigned sz)
+static int split_rtsp_data(struct rtsp_sess *sessp)
 {
-    int complete = 0;
+    struct last_data *lastp = &sessp->last_data;
+    struct intlvd *intlvdp = NULL;
+    unsigned int start = 0;     /* start of current message in buf */
+    unsigned int i = 0;
+    char c = 0;
+
+    while (start < lastp->sz) {
+        switch (lastp->state) {
+        case RECV_STATE_START:
+            if (lastp->buf[start] == '$') {
+                lastp->state = RECV_STATE_INTLVD;
+            } else {
+                lastp->state = RECV_STATE_HDRS;
+                lastp->pos = start;
+                lastp->line = start;
+                lastp->content_length = 0;
+            }
+            break;
+        case RECV_STATE_INTLVD:
+            if (lastp->sz - start < sizeof(*intlvdp)) {
+                goto more;
+            }
+            intlvdp = (struct intlvd *)(lastp->buf + start);
+            lastp->msg_sz = sizeof(*intlvdp) + ntohs(intlvdp->sz);
+            if (lastp->sz - start < lastp->msg_sz) {
+                goto more;
+            }
+            handle_intlvd_data(sessp, lastp->buf + start, lastp->msg_sz);
+            start += lastp->msg_sz;
+            lastp->state = RECV_STATE_START;
+            break;
+        case RECV_STATE_HDRS:
+            for (i = lastp->pos; i < lastp->sz; i++) {
+                if (lastp->buf[i] != '\n') {
+                    continue;
+                }
+                /* An empty line terminates the headers. */
+                if (i == lastp->line ||
+                    (i == lastp->line + 1 && lastp->buf[lastp->line] == '\r')) {
+                    lastp->msg_sz = i + 1 - start + lastp->content_length;
+                    lastp->state = RECV_STATE_BODY;
+                    break;
+                }
+                if (!strncasecmp(lastp->buf + lastp->line, "Content-Length:",
+                                 strlen("Content-Length:"))) {
+                    lastp->content_length = strtoul(lastp->buf + lastp->line +
+                                                    strlen("Content-Length:"), NULL, 10);
+                }
+                lastp->line = i + 1;
+            }
+            lastp->pos = i;
+            if (lastp->state != RECV_STATE_BODY) {
+                goto more;
+            }
+            break;
+        case RECV_STATE_BODY:
+            if (lastp->msg_sz >= RECV_BUF_SZ) {
+                printd(ERR "RTSP message[%u] is too large!\n", lastp->msg_sz);
+                return -1;
+            }
+            if (lastp->sz - start < lastp->msg_sz) {
+                goto more;
+            }
+            /* The parser treats the message as a string. */
+            c = lastp->buf[start + lastp->msg_sz];
+            lastp->buf[start + lastp->msg_sz] = '\0';
+            handle_intlvd_data(sessp, lastp->buf + start, lastp->msg_sz);
+            lastp->buf[start + lastp->msg_sz] = c;
+            start += lastp->msg_sz;
+            lastp->state = RECV_STATE_START;
+            break;
+        }
+    }
 
-    if (sz < 4) {
-        return complete;
+more:
+    /* Move the incomplete message to the beginning of buf. */
+    if (start) {
+        memmove(lastp->buf, lastp->buf + start, lastp->sz - start);
+        lastp->sz -= start;
+        lastp->pos -= (lastp->pos >= start) ? start : lastp->pos;
+        lastp->line -= (lastp->line >= start) ? start : lastp->line;
     }
-    
-    if (data[sz - 2] == '\r' && data[sz - 1] == '\n') {
-        complete = 1;
-    } else {
-        complete = 0;
+    if (lastp->sz >= RECV_BUF_SZ - 1) {
+        printd(ERR "Message is too large for receiving buffer!\n");
+        return -1;
     }
-    return complete;
+    return 0;
 }
 
 /**
  * Consider about the interleaved mode, we have to
  * filter out the RTP & RTCP packet.
+ *
+ * The rtsp_sd is edge-triggered, so read until there's nothing left.
  */
 static int recv_from_rtsp_sd(struct rtsp_sess *sessp)
 {
     ssize_t nr = 0;             /* bytes recv()ed. */
-    char recv_buf[RECV_BUF_SZ] = {0};
     int rtsp_sd = sessp->rtsp_sock.sd;
     struct last_data *lastp = &sessp->last_data;
-    struct intlvd *intlvdp = NULL;
-    char *ptr = NULL;
-    char *new = NULL;           /* New message block(RTSP/RTP/RTCP message) start */
-    unsigned left = 0;
 
-    nr = recv(rtsp_sd, recv_buf, RECV_BUF_SZ, 0);
-    if (nr <= 0) {
+    while (1) {
+        /* Reserve one byte for terminating the RTSP message. */
+        nr = recv(rtsp_sd, lastp->buf + lastp->sz, RECV_BUF_SZ - 1 - lastp->sz, 0);
         if (nr < 0) {
-            perrord(ERR "recv() from rtsp_sd error");
-        }
-        return -1;
-    }
-
-    ptr = recv_buf;
-    left = nr;
-    new = ptr;
-
-    /* handle the data in last buf */
-    if (lastp->sz >= sizeof(*intlvdp) && lastp->buf[0] == '$') {
-        intlvdp = (struct intlvd *)lastp->buf;
-        if (left >= ntohs(intlvdp->sz) + sizeof(*intlvdp) - lastp->sz) {
-            memcpy(lastp->buf + lastp->sz, ptr, ntohs(intlvdp->sz) + sizeof(*intlvdp) - lastp->sz);
-            printd("hulz--------->test: lastp->buf[0] = %c, lastp->sz = %d, handle_sz = %d\n", lastp->buf[0], lastp->sz, ntohs(intlvdp->sz) + sizeof(*intlvdp));
-            handle_intlvd_data(sessp, lastp->buf, ntohs(intlvdp->sz) + sizeof(*intlvdp));
-            ptr += ntohs(intlvdp->sz) + sizeof(*intlvdp) - lastp->sz;
-            left -= ntohs(intlvdp->sz) + sizeof(*intlvdp) - lastp->sz;
-            lastp->sz = 0;
-            new = ptr;
-        } else {
-            memcpy(lastp->buf + lastp->sz, ptr, left);
-            lastp->sz += left;
-            return 0;
-        }
-    }
-
-    while (left > 0) {
-        if (ptr[0] == '$') {
-            if (ptr != new) {
-                memcpy(lastp->buf + lastp->sz, new, ptr - new);
-                lastp->sz += ptr - new;
-                lastp->buf[lastp->sz] = 0;
-                printd("hulz--------->test: lastp->buf[0] = %c, lastp->sz = %d, handle_sz = %d\n", lastp->buf[0], lastp->sz, lastp->sz);
-                handle_intlvd_data(sessp, lastp->buf, lastp->sz);
-                lastp->sz = 0;
-                new = ptr;
+            if (errno == EINTR) {
+                continue;
             }
-
-            /* handle the new RTP/RTCP packet */
-            intlvdp = (struct intlvd *)new;
-            if (left >= sizeof(*intlvdp) &&
-                (left >= sizeof(*intlvdp) + ntohs(intlvdp->sz))) {
-                printd("hulz--------->test: new[0] = %c, handle_sz = %d\n", new[0], sizeof(*intlvdp) + ntohs(intlvdp->sz));
-                handle_intlvd_data(sessp, new, sizeof(*intlvdp) + ntohs(intlvdp->sz));
-                ptr += sizeof(*intlvdp) + ntohs(intlvdp->sz);
-                left -= sizeof(*intlvdp) + ntohs(intlvdp->sz);
-                new = ptr;
-            } else {
-                memcpy(lastp->buf, new, left);
-                lastp->sz = left;
-                left = 0;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
             }
-        } else {
-            ptr++;
-            left--;
+            perrord(ERR "recv() from rtsp_sd error");
+            return -1;
+        } else if (nr == 0) {
+            printd(WARNING "RTSP server closed the connection.\n");
+            return -1;
+        }
 
-            if (!left) {
-                memcpy(lastp->buf + lastp->sz, new, ptr - new);
-                lastp->sz += ptr - new;
-                if (rtsp_msg_complete(lastp->buf, lastp->sz)) {
-                    lastp->buf[lastp->sz] = 0;
-                    printd("hulz--------->test: lastp->buf[0] = %c, lastp->sz = %d, handle_sz = %d\n", lastp->buf[0], lastp->sz, lastp->sz);
-                    handle_intlvd_data(sessp, lastp->buf, lastp->sz);
-                    lastp->sz = 0;
-                } else {
-                    lastp->sz += ptr - new;
-                }
-            }
+        lastp->sz += nr;
+        if (split_rtsp_data(sessp) < 0) {
+            return -1;
         }
     }
 
@@ -237,6 +263,40 @@ int handle_rtp_sd(int sd, int ev, void *arg)
 
 int handle_rtcp_sd(int sd, int ev, void *arg)
 {
+    struct rtsp_sess *sessp = (struct rtsp_sess *)arg;
+    ssize_t nr = 0;
+    int i = 0;
+    char recv_buf[RTCP_PKT_SZ * 8];
+    enum media_type media = 0;
+
+    for (i = 0; i < 2; i++) {
+        if (sd == sessp->rtp_rtcp[i].udp.rtcp_sock.sd) {
+            media = i;
+            break;
+        }
+    }
+    if (i == 2) {
+        printd(ERR "Unmatched socket descriptor!\n");
+        return -1;
+    }
+
+    if (ev & EPOLLIN) {
+        nr = recvfrom(sd, recv_buf, sizeof(recv_buf), 0, NULL, 0);
+        if (nr <= 0) {
+            if (nr < 0) {
+                perrord(ERR "recvfrom() rtcp_sd error");
+            }
+            return -1;
+        }
+        handle_rtcp_pkt(sessp, media, recv_buf, nr);
+    }
+
+    if (ev & EPOLLOUT) {
+        if (consume_send_buf(sessp, DATA_TYPE_RTCP_V_PKT |
+                             DATA_TYPE_RTCP_A_PKT) < 0) {
+            return -1;
+        }
+    }
     return 0;
 }
 
@@ -258,6 +318,9 @@ int do_sd_handler(int sd, int ev, struct rtsp_sess *sessp)
     }
 
     if (sockp) {
+        if (ev & EPOLLIN) {
+            sessp->last_recv = time_now();
+        }
         if (sockp->handler(sd, ev, sessp) < 0) {
             return -1;
         }
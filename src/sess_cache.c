@@ -0,0 +1,143 @@
+/*********************************************************************
+ * File Name    : sess_cache.c
+ * Description  : Cache of what we learned from RTSP server,
+ *                used to reconnect quickly.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-01-10
+ ********************************************************************/
+
+#include <stdio.h>
+#include "log.h"
+#include "util.h"
+#include "list.h"
+#include "rtsp_cli.h"
+#include "parser.h"
+#include "sess_cache.h"
+
+
+/* Must be called with rtsp_cli.cache_mutex held. */
+static struct sess_cache *find_sess_cache(const char *uri)
+{
+    struct sess_cache *cachep = NULL;
+
+    list_for_each_entry(cachep, &rtsp_cli.sess_cache_list, entry) {
+        if (!strcmp(cachep->uri, uri)) {
+            return cachep;
+        }
+    }
+    return NULL;
+}
+
+static void free_sess_cache(struct sess_cache *cachep)
+{
+    list_del(&cachep->entry);
+    free_sdp_info(cachep->sdp_info);
+    freez(cachep);
+    return;
+}
+
+/**
+ * Remember the public methods and SDP of the session.
+ * Called when the session starts playing.
+ */
+int save_sess_cache(struct rtsp_sess *sessp)
+{
+    struct sess_cache *cachep = NULL;
+    struct sdp_info *sdp = NULL;
+    int i = 0;
+
+    if (!sessp->sdp_info) {
+        return -1;
+    }
+    sdp = dup_sdp_info(sessp->sdp_info);
+    if (!sdp) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&rtsp_cli.cache_mutex);
+    cachep = find_sess_cache(sessp->uri);
+    if (!cachep) {
+        cachep = mallocz(sizeof(*cachep));
+        if (!cachep) {
+            pthread_mutex_unlock(&rtsp_cli.cache_mutex);
+            printd(ERR "Allocate memory for struct sess_cache failed!\n");
+            free_sdp_info(sdp);
+            return -1;
+        }
+        snprintf(cachep->uri, sizeof(cachep->uri), "%s", sessp->uri);
+        list_add_tail(&cachep->entry, &rtsp_cli.sess_cache_list);
+    }
+
+    for (i = 0; i < RTSP_METHOD_NUM; i++) {
+        cachep->supported[i] = sessp->supported_method[i].supported;
+    }
+    free_sdp_info(cachep->sdp_info);
+    cachep->sdp_info = sdp;
+    pthread_mutex_unlock(&rtsp_cli.cache_mutex);
+
+    return 0;
+}
+
+/**
+ * Fill the session with what we cached for its URI.
+ *
+ * Return 1 if found, 0 if not found, -1 if error occured.
+ */
+int load_sess_cache(struct rtsp_sess *sessp)
+{
+    struct sess_cache *cachep = NULL;
+    struct sdp_info *sdp = NULL;
+    int i = 0;
+
+    pthread_mutex_lock(&rtsp_cli.cache_mutex);
+    cachep = find_sess_cache(sessp->uri);
+    if (!cachep) {
+        pthread_mutex_unlock(&rtsp_cli.cache_mutex);
+        return 0;
+    }
+    sdp = dup_sdp_info(cachep->sdp_info);
+    if (!sdp) {
+        pthread_mutex_unlock(&rtsp_cli.cache_mutex);
+        return -1;
+    }
+    for (i = 0; i < RTSP_METHOD_NUM; i++) {
+        sessp->supported_method[i].supported = cachep->supported[i];
+    }
+    pthread_mutex_unlock(&rtsp_cli.cache_mutex);
+
+    free_sdp_info(sessp->sdp_info);
+    sessp->sdp_info = sdp;
+    sessp->cache_used = 1;
+
+    printd(INFO "Reconnect %s with cached SDP.\n", sessp->uri);
+    return 1;
+}
+
+/**
+ * Forget the URI, e.g. the server rejected what we cached.
+ */
+void drop_sess_cache(const char *uri)
+{
+    struct sess_cache *cachep = NULL;
+
+    pthread_mutex_lock(&rtsp_cli.cache_mutex);
+    cachep = find_sess_cache(uri);
+    if (cachep) {
+        free_sess_cache(cachep);
+    }
+    pthread_mutex_unlock(&rtsp_cli.cache_mutex);
+    return;
+}
+
+void clear_sess_cache(void)
+{
+    struct sess_cache *cachep = NULL;
+    struct sess_cache *tmp = NULL;
+
+    pthread_mutex_lock(&rtsp_cli.cache_mutex);
+    list_for_each_entry_safe(cachep, tmp, &rtsp_cli.sess_cache_list, entry) {
+        free_sess_cache(cachep);
+    }
+    pthread_mutex_unlock(&rtsp_cli.cache_mutex);
+    return;
+}
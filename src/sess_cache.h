@@ -0,0 +1,32 @@
+/*********************************************************************
+ * File Name    : sess_cache.h
+ * Description  : Cache of what we learned from RTSP server,
+ *                used to reconnect quickly.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-01-10
+ ********************************************************************/
+
+#ifndef __SESS_CACHE_H__
+#define __SESS_CACHE_H__
+
+
+/*
+ * After a session played successfully, we keep the public methods
+ * and the SDP of the URI here. When connecting to the same URI again,
+ * OPTIONS and DESCRIBE can be skipped and we go straight to SETUP.
+ */
+struct sess_cache {
+    struct list_head entry;         /* entry of session cache list */
+    char uri[MAX_URI_SZ];           /* key of the cache */
+    int supported[RTSP_METHOD_NUM]; /* RTSP method supported by RTSP server */
+    struct sdp_info *sdp_info;      /* includes control URLs of the tracks */
+};
+
+struct rtsp_sess;
+int save_sess_cache(struct rtsp_sess *sessp);
+int load_sess_cache(struct rtsp_sess *sessp);
+void drop_sess_cache(const char *uri);
+void clear_sess_cache(void);
+
+
+#endif /* __SESS_CACHE_H__ */
@@ -0,0 +1,137 @@
+/*********************************************************************
+ * File Name    : shm_reader.c
+ * Description  : Consume the shared memory frame ring of a channel
+ *                from another process, see frm_shm.h.
+ *                It doesn't depend on the rest of the library.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-03-05
+ ********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "frm_shm.h"
+
+
+int open_frm_shm(struct frm_shm_reader *rp, int fd)
+{
+    const struct frm_shm_hdr *hdr = NULL;
+    struct stat st;
+    void *p = NULL;
+
+    memset(rp, 0, sizeof(*rp));
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*hdr)) {
+        return -1;
+    }
+
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+    hdr = p;
+    if (hdr->magic != FRM_SHM_MAGIC || hdr->version != FRM_SHM_VERSION ||
+        (uint64_t)hdr->data_off + hdr->data_sz > (uint64_t)st.st_size) {
+        munmap(p, st.st_size);
+        return -1;
+    }
+
+    rp->hdr = hdr;
+    rp->data = (const char *)p + hdr->data_off;
+    rp->map_sz = st.st_size;
+    rp->pos = __atomic_load_n(&hdr->last, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+void close_frm_shm(struct frm_shm_reader *rp)
+{
+    if (rp->hdr) {
+        munmap((void *)rp->hdr, rp->map_sz);
+        rp->hdr = NULL;
+    }
+    return;
+}
+
+/* Whether bytes from pos on haven't been overwritten. */
+static inline int pos_valid(const struct frm_shm_hdr *hdr, uint64_t pos)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&hdr->tail, __ATOMIC_RELAXED) <= pos;
+}
+
+int read_frm_shm(struct frm_shm_reader *rp, struct frm_shm_frm *frmp)
+{
+    const struct frm_shm_hdr *hdr = rp->hdr;
+    const struct frm_shm_rec *recp = NULL;
+    struct frm_shm_rec rec;
+    uint64_t head = 0;
+    uint32_t off = 0;
+
+    while (1) {
+        head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+        if (rp->pos >= head) {
+            return 0;
+        }
+
+        off = rp->pos & (hdr->data_sz - 1);
+        recp = (const struct frm_shm_rec *)(rp->data + off);
+        memcpy(&rec, recp, sizeof(rec));
+        if (!pos_valid(hdr, rp->pos) || rec.rec_sz < sizeof(rec) ||
+            rec.rec_sz > hdr->data_sz - off) {
+            /* Fallen behind, resync to the newest frame. */
+            rp->pos = __atomic_load_n(&hdr->last, __ATOMIC_ACQUIRE);
+            continue;
+        }
+
+        if (rec.frm_type == FRM_SHM_TYPE_PAD) {
+            rp->pos += rec.rec_sz;
+            continue;
+        }
+
+        frmp->frm_type = rec.frm_type;
+        frmp->flags = rec.flags;
+        frmp->ts = rec.ts;
+        frmp->frm_sz = rec.frm_sz;
+        frmp->nalu_num = rec.nalu_num;
+        frmp->frm_no = rec.frm_no;
+        frmp->frm = (const char *)(recp + 1);
+        frmp->nalu = rec.nalu_num ?
+            frmp->frm + ((rec.frm_sz + FRM_SHM_ALIGN - 1) & ~(FRM_SHM_ALIGN - 1)) : NULL;
+        frmp->pos = rp->pos;
+        rp->pos += rec.rec_sz;
+        if (rp->next_no && rec.frm_no > rp->next_no) {
+            rp->lost += rec.frm_no - rp->next_no;
+        }
+        rp->next_no = rec.frm_no + 1;
+        return 1;
+    }
+}
+
+int frm_shm_valid(const struct frm_shm_reader *rp, const struct frm_shm_frm *frmp)
+{
+    return pos_valid(rp->hdr, frmp->pos);
+}
+
+int wait_frm_shm(struct frm_shm_reader *rp, int timeout)
+{
+    const struct frm_shm_hdr *hdr = rp->hdr;
+    struct timespec ts;
+    uint32_t seq = 0;
+
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000;
+
+    /* Load seq first, the writer bumps it after moving head. */
+    seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+    if (rp->pos < __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE)) {
+        return 1;
+    }
+    syscall(SYS_futex, &hdr->seq, FUTEX_WAIT, seq, timeout < 0 ? NULL : &ts, NULL, 0);
+    return rp->pos < __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+}
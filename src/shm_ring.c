@@ -0,0 +1,165 @@
+/*********************************************************************
+ * File Name    : shm_ring.c
+ * Description  : Publish frames of a channel into a shared memory
+ *                ring, see inc/frm_shm.h for its layout.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-03-05
+ ********************************************************************/
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "log.h"
+#include "util.h"
+#include "rtsp_cli.h"
+#include "shm_ring.h"
+
+
+#define SHM_ALIGN(sz)   (((sz) + FRM_SHM_ALIGN - 1) & ~(FRM_SHM_ALIGN - 1))
+
+/**
+ * Create the ring in a sealed memfd, readers map it read-only.
+ */
+int create_shm_ring(struct rtsp_sess *sessp)
+{
+    struct shm_ring *ringp = NULL;
+    unsigned int data_off = SHM_ALIGN(sizeof(struct frm_shm_hdr));
+    void *p = NULL;
+
+    ringp = mallocz(sizeof(*ringp));
+    if (!ringp) {
+        printd(ERR "Allocate memory for shm ring failed!\n");
+        return -1;
+    }
+    ringp->map_sz = data_off + DFL_SHM_DATA_SZ;
+
+    ringp->fd = memfd_create("rtspcli-frm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (ringp->fd < 0) {
+        printd(ERR "memfd_create() error: %s\n", strerror(errno));
+        freez(ringp);
+        return -1;
+    }
+    if (ftruncate(ringp->fd, ringp->map_sz) < 0 ||
+        fcntl(ringp->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        printd(ERR "Size shm ring error: %s\n", strerror(errno));
+        close(ringp->fd);
+        freez(ringp);
+        return -1;
+    }
+
+    p = mmap(NULL, ringp->map_sz, PROT_READ | PROT_WRITE, MAP_SHARED, ringp->fd, 0);
+    if (p == MAP_FAILED) {
+        printd(ERR "mmap() shm ring error: %s\n", strerror(errno));
+        close(ringp->fd);
+        freez(ringp);
+        return -1;
+    }
+    ringp->hdr = p;
+    ringp->data = (char *)p + data_off;
+
+    ringp->hdr->version = FRM_SHM_VERSION;
+    ringp->hdr->data_off = data_off;
+    ringp->hdr->data_sz = DFL_SHM_DATA_SZ;
+    __atomic_store_n(&ringp->hdr->magic, FRM_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    sessp->shm_ring = ringp;
+    return 0;
+}
+
+void destroy_shm_ring(struct rtsp_sess *sessp)
+{
+    struct shm_ring *ringp = sessp->shm_ring;
+
+    if (!ringp) {
+        return;
+    }
+    munmap(ringp->hdr, ringp->map_sz);
+    close(ringp->fd);
+    freez(sessp->shm_ring);
+    return;
+}
+
+/**
+ * Write a record at pos, tail is moved past the bytes to be
+ * overwritten before they're touched.
+ */
+static void write_shm_rec(struct shm_ring *ringp, unsigned long long pos,
+                          const struct frm_shm_rec *recp, const char *frm,
+                          const struct nalu_info *nalu)
+{
+    struct frm_shm_hdr *hdr = ringp->hdr;
+    char *p = ringp->data + (pos & (hdr->data_sz - 1));
+    unsigned long long end = pos + recp->rec_sz;
+
+    if (end > hdr->data_sz) {
+        __atomic_store_n(&hdr->tail, end - hdr->data_sz, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    memcpy(p, recp, sizeof(*recp));
+    if (frm) {
+        memcpy(p + sizeof(*recp), frm, recp->frm_sz);
+        if (nalu) {
+            memcpy(p + sizeof(*recp) + SHM_ALIGN(recp->frm_sz), nalu,
+                   recp->nalu_num * sizeof(*nalu));
+        }
+    }
+    __atomic_store_n(&hdr->head, end, __ATOMIC_RELEASE);
+    return;
+}
+
+/**
+ * Publish the frame, readers falling behind lose frames
+ * instead of blocking the writer. Frames larger than half
+ * of the ring are skipped.
+ */
+void publish_shm_frm(struct shm_ring *ringp, const struct frm_info *frmp,
+                     unsigned int frm_hdr_sz)
+{
+    struct frm_shm_hdr *hdr = ringp->hdr;
+    struct frm_shm_rec rec;
+    struct frm_shm_rec pad;
+    unsigned long long pos = hdr->head;
+    unsigned int left = hdr->data_sz - (pos & (hdr->data_sz - 1));
+    unsigned int nalu_num = frmp->nalu ? frmp->nalu_num : 0;
+
+    if (nalu_num > MAX_NALU_NUM) {
+        nalu_num = 0;           /* index is incomplete */
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.rec_sz = sizeof(rec) + SHM_ALIGN(frmp->frm_sz) +
+        SHM_ALIGN(nalu_num * sizeof(struct nalu_info));
+    if (rec.rec_sz > hdr->data_sz / 2) {
+        printd(WARNING "Frame too large for shm ring, skip it!\n");
+        return;
+    }
+
+    /* Records never wrap around, pad to the start of data area. */
+    if (rec.rec_sz > left) {
+        memset(&pad, 0, sizeof(pad));
+        pad.frm_type = FRM_SHM_TYPE_PAD;
+        pad.rec_sz = left;
+        write_shm_rec(ringp, pos, &pad, NULL, NULL);
+        pos += left;
+    }
+
+    rec.frm_type = frmp->frm_type;
+    rec.flags = frmp->flags;
+    rec.ts = frmp->ts;
+    rec.frm_sz = frmp->frm_sz;
+    rec.nalu_num = nalu_num;
+    rec.frm_no = ++ringp->frm_no;
+    write_shm_rec(ringp, pos, &rec, frmp->frm_buf + frm_hdr_sz, nalu_num ? frmp->nalu : NULL);
+    __atomic_store_n(&hdr->last, pos, __ATOMIC_RELEASE);
+
+    /* Readers map it read-only, so they can't tell if they're waiting. */
+    __atomic_add_fetch(&hdr->seq, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &hdr->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    return;
+}
@@ -0,0 +1,34 @@
+/*********************************************************************
+ * File Name    : shm_ring.h
+ * Description  : Publish frames of a channel into a shared memory
+ *                ring, see inc/frm_shm.h for its layout.
+ * Author       : Hu Lizhen
+ * Create Date  : 2013-03-05
+ ********************************************************************/
+
+#ifndef __SHM_RING_H__
+#define __SHM_RING_H__
+
+
+#include "librtspcli.h"
+#include "frm_shm.h"
+
+#define DFL_SHM_DATA_SZ     (4 * 1024 * 1024)   /* power of 2 */
+
+/* writer of the ring */
+struct shm_ring {
+    int fd;                         /* memfd, sealed against resizing */
+    struct frm_shm_hdr *hdr;
+    char *data;
+    unsigned int map_sz;
+    unsigned long long frm_no;
+};
+
+struct rtsp_sess;
+int create_shm_ring(struct rtsp_sess *sessp);
+void destroy_shm_ring(struct rtsp_sess *sessp);
+void publish_shm_frm(struct shm_ring *ringp, const struct frm_info *frmp,
+                     unsigned int frm_hdr_sz);
+
+
+#endif /* __SHM_RING_H__ */
@@ -203,6 +203,52 @@ int set_block_mode(int fd, int mode)
     return 0;
 }
 
+/**
+ * Decode @len characters of base64 string @in to @out.
+ *
+ * Return the size of decoded data, -1 if @in is illegal
+ * or @out isn't large enough.
+ */
+int base64_decode(const char *in, unsigned int len, char *out, unsigned int sz)
+{
+    unsigned int i = 0;
+    unsigned int n = 0;         /* bytes decoded */
+    unsigned int bits = 0;
+    unsigned int nbits = 0;
+    int val = 0;
+    char c = 0;
+
+    for (i = 0; i < len; i++) {
+        c = in[i];
+        if (c >= 'A' && c <= 'Z') {
+            val = c - 'A';
+        } else if (c >= 'a' && c <= 'z') {
+            val = c - 'a' + 26;
+        } else if (c >= '0' && c <= '9') {
+            val = c - '0' + 52;
+        } else if (c == '+') {
+            val = 62;
+        } else if (c == '/') {
+            val = 63;
+        } else if (c == '=') {
+            break;
+        } else {
+            return -1;
+        }
+
+        bits = (bits << 6) | val;
+        nbits += 6;
+        if (nbits >= 8) {
+            nbits -= 8;
+            if (n >= sz) {
+                return -1;
+            }
+            out[n++] = (bits >> nbits) & 0xFF;
+        }
+    }
+    return n;
+}
+
 char *make_date_hdr(void)
 {
     static char date[MAX_DATE_SZ] = {0};
@@ -119,6 +119,8 @@ int monitor_sd_event(int ep_fd, int fd, unsigned int ev);
 int update_sd_event(int ep_fd, int fd, unsigned int ev);
 int set_block_mode(int fd, int mode);
 
+int base64_decode(const char *in, unsigned int len, char *out, unsigned int sz);
+
 char *make_date_hdr(void);
 unsigned long long time_now(void);
 void print_hex(const char *buf, unsigned sz);